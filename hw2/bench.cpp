@@ -0,0 +1,124 @@
+// Tetris engine micro-benchmarks: `make bench`
+// Every workload is seeded, so runs are comparable between builds. Output is one JSON
+// object per line: {"workload", "bench", "calls", "ns_per_call", "calls_per_sec", "allocs_per_call"}.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include "tetris.h"
+
+using namespace std;
+using A = Tetris::Action;
+
+// --- allocation counting ---
+static size_t g_allocs = 0;
+
+void *operator new(size_t n) {
+    ++g_allocs;
+    if (void *p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static volatile uint64_t g_sink; // keeps results observable so calls are not optimized out
+
+struct TetrisBench {
+    static bool canPlace(const Tetris &t, const Tetris::Active &a) { return t.canPlace(a); }
+    static void computeGhost(Tetris &t) { t.computeGhost(); }
+    static int clearLines(Tetris &t) { return t.clearLinesAndScore(); }
+
+    // Fill the bottom `height` rows, leaving one random hole per row so none is cleared.
+    static void fillRows(Tetris &t, int height, mt19937 &rng) {
+        for (int y = Tetris::kHeight - height; y < Tetris::kHeight; ++y) {
+            int hole = rng() % Tetris::kWidth;
+            for (int x = 0; x < Tetris::kWidth; ++x) setCell(t, x, y, x == hole ? 0 : 1 + rng() % 7);
+        }
+        t.computeGhost();
+    }
+
+    // Make the bottom `n` rows full so the next clear has work to do.
+    static void fullRows(Tetris &t, int n) {
+        for (int y = Tetris::kHeight - n; y < Tetris::kHeight; ++y)
+            for (int x = 0; x < Tetris::kWidth; ++x) setCell(t, x, y, 1 + (x % 7));
+    }
+
+    static void setCell(Tetris &t, int x, int y, int v) {
+        t.board_[Tetris::idx(x, y)] = static_cast<uint8_t>(v);
+        uint16_t bit = static_cast<uint16_t>(1u << (x + Tetris::kWallBits));
+        if (v) t.rows_[y] |= bit;
+        else t.rows_[y] &= static_cast<uint16_t>(~bit);
+    }
+};
+
+template <class F>
+static void run(const char *workload, const char *bench, long calls, F &&f) {
+    size_t allocs0 = g_allocs;
+    auto t0 = chrono::steady_clock::now();
+    for (long i = 0; i < calls; ++i) f(i);
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+    size_t allocs = g_allocs - allocs0;
+    printf("{\"workload\":\"%s\",\"bench\":\"%s\",\"calls\":%ld,\"ns_per_call\":%.2f,\"calls_per_sec\":%.0f,\"allocs_per_call\":%.3f}\n",
+           workload, bench, calls, ns / calls, calls * 1e9 / ns, (double)allocs / calls);
+    fflush(stdout);
+}
+
+// Times the engine on one workload: `next` picks each step's action, `prepare` sets up
+// (and after a top-out, restores) the board the workload is about.
+template <class Next, class Prepare>
+static void workload(const char *name, uint32_t seed, long steps, Next &&next, Prepare &&prepare) {
+    mt19937 rng(seed);
+    Tetris t(seed, 10);
+    prepare(t, rng);
+    run(name, "step", steps, [&](long) {
+        if (t.state().gameOver) {
+            t.reset();
+            prepare(t, rng);
+        }
+        g_sink += t.step(next(rng));
+    });
+
+    // The hot paths, on whatever board the workload left behind
+    if (t.state().gameOver) {
+        t.reset();
+        prepare(t, rng);
+    }
+    Tetris::Active probe = t.state().active;
+    run(name, "canPlace", steps * 4, [&](long i) {
+        probe.x = -2 + (int)(i % 13);
+        probe.y = (int)(i % Tetris::kHeight) - 1;
+        probe.rot = (int)(i & 3);
+        g_sink += TetrisBench::canPlace(t, probe);
+    });
+    run(name, "computeGhost", steps, [&](long) {
+        TetrisBench::computeGhost(t);
+        g_sink += t.state().ghostY;
+    });
+    run(name, "to_json", steps / 10, [&](long) { g_sink += t.to_json().size(); });
+    run(name, "to_json_dump", steps / 10, [&](long) { g_sink += t.to_json().dump().size(); });
+    uint8_t buf[Tetris::kBinarySize];
+    run(name, "write_binary", steps, [&](long) {
+        t.write_binary(buf);
+        g_sink += buf[0];
+    });
+    // includes refilling the 4 full rows every call
+    Tetris lines(seed, 10);
+    run(name, "clearLinesAndScore_4rows", steps, [&](long) {
+        TetrisBench::fullRows(lines, 4);
+        g_sink += TetrisBench::clearLines(lines);
+    });
+}
+
+int main(int argc, char **argv) {
+    long steps = argc > 1 ? atol(argv[1]) : 200000;
+    auto none = [](Tetris &, mt19937 &) {};
+
+    workload("random", 1, steps, [](mt19937 &rng) { return static_cast<A>(rng() % 8); }, none);
+    workload("harddrop", 2, steps, [](mt19937 &) { return A::HardDrop; }, none);
+    workload("near_topout", 3, steps,
+             [](mt19937 &rng) { return static_cast<A>(rng() % 8); },
+             [](Tetris &t, mt19937 &rng) { TetrisBench::fillRows(t, 15, rng); });
+    return 0;
+}
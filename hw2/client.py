@@ -6,6 +6,8 @@ import pygame
 SERVER_IP ="140.113.17.11"
 # SERVER_IP = "127.0.0.1"
 SERVER_PORT = 45632
+GAME_PLAY_PORT = 45633  # shared by every match, the handshake names the room
+SNAPSHOT_FORMAT = "delta"  # "full" resends both boards every frame, "binary" packs them
 
 
 # ========= Length-prefixed message helpers =========
@@ -20,8 +22,8 @@ def recv_exact(sock, n):
     return buf
 
 
-def recv_msg(sock):
-    """Receive a single length-prefixed JSON message (C++ compatible)."""
+def recv_frame(sock):
+    """Receive a single length-prefixed frame as raw bytes (C++ compatible)."""
     hdr = recv_exact(sock, 4)
     if not hdr:
         return None
@@ -29,12 +31,46 @@ def recv_msg(sock):
     if length <= 0 or length > 65536:
         print("Invalid length from server:", length)
         return None
-    payload = recv_exact(sock, length)
+    return recv_exact(sock, length)
+
+
+def recv_msg(sock):
+    """Receive a single length-prefixed JSON message (C++ compatible)."""
+    payload = recv_frame(sock)
     if not payload:
         return None
     return payload.decode("utf-8")
 
 
+def show_event(ev):
+    """Print a lobby event the server pushed (room changes, invites, players' status)."""
+    data = ev.get('data', {})
+    kind, op = ev.get('event'), ev.get('op')
+    if kind == 'invite':
+        print(f"\n📨 {data.get('hostUser')} invited you to room '{data.get('name')}'")
+    elif kind == 'room' and op == 'create':
+        print(f"\n🆕 Room '{data.get('name')}' opened by {data.get('hostUser')}")
+    elif kind == 'room' and op == 'update' and data.get('oppoUser'):
+        print(f"\n👥 Room '{data.get('name')}': {data.get('hostUser')} vs {data.get('oppoUser')} ({data.get('status')})")
+    elif kind == 'user':
+        print(f"\n👤 {data.get('name')} is now {data.get('status')}")
+
+
+def recv_reply(sock):
+    """Receive the reply to the last request, showing any events pushed before it."""
+    while True:
+        msg = recv_msg(sock)
+        if not msg:
+            return msg
+        try:
+            obj = json.loads(msg)
+        except Exception:
+            return msg
+        if not isinstance(obj, dict) or 'event' not in obj:
+            return msg
+        show_event(obj)
+
+
 def send_msg(sock, obj):
     """Send a JSON message with a 4-byte length prefix."""
     data = json.dumps(obj, separators=(",", ":")).encode("utf-8")
@@ -73,7 +109,7 @@ def lobby_op(sock, action: str, roomname:str=""):
             "action": action
         }
         send_msg(sock, req)
-        reply = recv_msg(sock)
+        reply = recv_reply(sock)
         if not reply:
             print("⚠️  No reply or disconnected from server.")
             return False, None
@@ -114,8 +150,21 @@ def lobby_op(sock, action: str, roomname:str=""):
                         print("⚠️  Difficulty must be between 2 and 10. Try again.")
                 except ValueError:
                     print("⚠️  Please enter a valid number.")
+            while True:
+                try:
+                    rate_input = input("Ticks per second (5~60, default=10): ").strip()
+                    if rate_input == "":
+                        break
+                    rate = int(rate_input)
+                    if 5 <= rate <= 60:
+                        req["tickRate"] = rate
+                        break
+                    else:
+                        print("⚠️  Tick rate must be between 5 and 60. Try again.")
+                except ValueError:
+                    print("⚠️  Please enter a valid number.")
         send_msg(sock, req)
-        reply = recv_msg(sock)
+        reply = recv_reply(sock)
         if not reply:
             print("⚠️  No reply or disconnected from server.")
             return False, None
@@ -125,7 +174,7 @@ def lobby_op(sock, action: str, roomname:str=""):
                 if action == 'spec':
                     print('✅ Successfully joined as spectator')
                     # Expect an immediate follow-up message that contains room info
-                    next_msg = recv_msg(sock)
+                    next_msg = recv_reply(sock)
                     if not next_msg:
                         print("⚠️  Did not receive room info for spectating.")
                         return False, None
@@ -159,7 +208,7 @@ def room_op(sock, action:str):
             "name": toinvite
         }
         send_msg(sock, req)
-        reply = recv_msg(sock)
+        reply = recv_reply(sock)
         if not reply:
             print("⚠️  No reply or disconnected from server.")
             return -1
@@ -179,7 +228,7 @@ def room_op(sock, action:str):
             "action": action,
         }
         send_msg(sock, req)
-        reply = recv_msg(sock)
+        reply = recv_reply(sock)
         if not reply:
             print("⚠️  No reply or disconnected from server.")
             return -1
@@ -266,6 +315,98 @@ def convert_board_to_2d(board_array):
     return board
 
 
+def piece_cells_at(piece_id, rot):
+    """Board-local (dx, dy) cells of a piece, matching the server's Tetris::cell()."""
+    shape = set(SHAPES.get(piece_id, []))
+    cells = []
+    for dy in range(4):
+        for dx in range(4):
+            r = rot % 4
+            x, y = dx, dy
+            if r == 1:
+                x, y = 3 - dy, dx
+            elif r == 2:
+                x, y = 3 - dx, 3 - dy
+            elif r == 3:
+                x, y = dy, 3 - dx
+            if (x, y) in shape:
+                cells.append((dx, dy))
+    return cells
+
+
+def compose_board(state):
+    """Locked cells plus ghost (8) and active piece (9), like the server's to_json()."""
+    board = list(state['b'])
+    piece, px, py, rot, ghost_y = state['p']
+    if piece > 0:
+        cells = piece_cells_at(piece, rot)
+        for dx, dy in cells:
+            bx, by = px + dx, ghost_y + dy
+            if 0 <= bx < 10 and 0 <= by < 20 and board[by * 10 + bx] == 0 and by != py + dy:
+                board[by * 10 + bx] = 8
+        for dx, dy in cells:
+            bx, by = px + dx, py + dy
+            if 0 <= bx < 10 and 0 <= by < 20:
+                board[by * 10 + bx] = 9
+    return board
+
+
+def decode_binary(payload, players):
+    """Unpack a "binary" format frame into the "full" layout, games in host, opponent order."""
+    version, frame = struct.unpack_from("!BI", payload, 0)
+    if version != 2:
+        raise ValueError(f"unknown binary snapshot version {version}")
+    data = {'f': frame}
+    off = 5
+    for i in range((len(payload) - 5) // 116):
+        packed = payload[off:off + 100]
+        board = []
+        for byte in packed:
+            board.append(byte >> 4)
+            board.append(byte & 0x0F)
+        hold, score, lines, level, over, seq = struct.unpack_from("!BIIHBI", payload, off + 100)
+        name = players[i] if i < len(players) else f"p{i + 1}"
+        data[name] = {'b': board, 'h': hold, 's': score, 'l': lines, 'v': level, 'g': bool(over), 'q': seq}
+        off += 116
+    return data
+
+
+def parse_game_frame(payload, players):
+    """JSON control messages and snapshots, or packed "binary" snapshots."""
+    if payload[:1] == b"{":
+        return json.loads(payload.decode("utf-8"))
+    return decode_binary(payload, players)
+
+
+def apply_snapshot(data, states):
+    """Fold one snapshot into `states` and return {player: state} in the "full" layout.
+
+    With the "delta" format a frame with "k" is a keyframe holding every field, any other
+    frame only carries what changed: "c" as flat [index, value, ...] locked cell pairs,
+    "p" the active piece [id, x, y, rot, ghostY], and h/s/l/v/g when they change.
+    """
+    frame_states = {}
+    for name, upd in data.items():
+        if not isinstance(upd, dict):  # "f", "k" and ack fields ("ack", "seq", "rejected")
+            continue
+        if SNAPSHOT_FORMAT != "delta":
+            frame_states[name] = upd
+            continue
+        if data.get('k') or name not in states:
+            states[name] = {'b': [0] * 200, 'p': [0, 0, 0, 0, 0], 'h': 0, 's': 0, 'l': 0, 'v': 1, 'g': False}
+        st = states[name]
+        for key, value in upd.items():
+            if key == 'c':
+                for i in range(0, len(value), 2):
+                    st['b'][value[i]] = value[i + 1]
+            elif key == 'b':
+                st['b'] = list(value)
+            else:
+                st[key] = value
+        frame_states[name] = dict(st, b=compose_board(st))
+    return frame_states
+
+
 def draw_mini_board(screen, game_state, x, y, cell_size, label):
     """Draw a miniature Tetris board."""
     BOARD_WIDTH = 10
@@ -495,7 +636,7 @@ def draw_spectator_view(screen, player_states, frame_no, spectator_name):
     pygame.display.flip()
 
 
-def play_game(lobby_sock, room_id, player_name,):
+def play_game(lobby_sock, room_id, player_name, players=()):
     """Connect to game server and play with pygame GUI."""
     # Initialize pygame
     pygame.init()
@@ -503,16 +644,18 @@ def play_game(lobby_sock, room_id, player_name,):
     pygame.display.set_caption("Tetris Battle")
     clock = pygame.time.Clock()
 
-    # Connect to the game server (room_id determines port)
-    game_port = room_id + 50000
+    # Connect to the shared gameplay port, the handshake tells the server which room
+    game_port = GAME_PLAY_PORT
     game_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    game_sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)  # each keypress goes out at once
 
     try:
         print(f"Connecting to game server on port {game_port}...")
         game_sock.connect((SERVER_IP, game_port))
         print(f"✅ Connected to game on port {game_port}!")
         # Identify ourselves to the game server
-        send_msg(game_sock, {"action": "ready", "name": player_name})
+        send_msg(game_sock, {"action": "ready", "name": player_name, "room": room_id,
+                             "format": SNAPSHOT_FORMAT})
     except Exception as e:
         print(f"❌ Failed to connect to game server: {e}")
         pygame.quit()
@@ -521,6 +664,8 @@ def play_game(lobby_sock, room_id, player_name,):
     running = True
     my_state = {}
     opponent_state = {}
+    board_states = {}  # per-player state the delta frames apply to
+    seq = 0  # numbers our actions; acks and each snapshot's "q" say which were applied
 
     # Main game loop
     while running:
@@ -550,7 +695,8 @@ def play_game(lobby_sock, room_id, player_name,):
                 # Send action to server
                 if action:
                     try:
-                        send_msg(game_sock, {"action": action})
+                        seq += 1
+                        send_msg(game_sock, {"action": action, "seq": seq})
                     except Exception as e:
                         print(f"Failed to send action: {e}")
 
@@ -558,9 +704,9 @@ def play_game(lobby_sock, room_id, player_name,):
         try:
             readable, _, _ = select.select([game_sock], [], [], 0)
             if readable:
-                msg = recv_msg(game_sock)
+                msg = recv_frame(game_sock)
                 if msg:
-                    data = json.loads(msg)
+                    data = parse_game_frame(msg, players)
 
                     # Check for game_over notification
                     if data.get('action') == 'game_over':
@@ -596,10 +742,15 @@ def play_game(lobby_sock, room_id, player_name,):
                         print(f"  Max Combo: {opponent_result.get('maxCombo', 0)}")
                         print("="*50)
                         running = False
+                    # Ack of one of our actions, carrying only our own board
+                    elif 'ack' in data:
+                        mine = apply_snapshot(data, board_states).get(player_name)
+                        if mine:
+                            my_state = mine
                     # Server sends: {"f": frame, "username1": {...}, "username2": {...}}
                     elif 'f' in data:
-                        # Extract usernames from data (all keys except 'f')
-                        player_keys = [k for k in data.keys() if k != 'f']
+                        data = apply_snapshot(data, board_states)
+                        player_keys = list(data.keys())
 
                         if len(player_keys) >= 2:
                             # Identify which one is current player by removing "(SPECTATOR)" suffix
@@ -656,21 +807,22 @@ def play_game(lobby_sock, room_id, player_name,):
     print("Game ended.")
 
 
-def spectate_game(room_id, spectator_name):
+def spectate_game(room_id, spectator_name, players=()):
     """Connect to an active room as spectator and render both boards."""
     pygame.init()
     screen = pygame.display.set_mode((740, 720))
     pygame.display.set_caption(f"Tetris Spectator - {spectator_name}")
     clock = pygame.time.Clock()
 
-    game_port = room_id + 50000
+    game_port = GAME_PLAY_PORT
     game_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
 
     try:
         print(f"Connecting to game server on port {game_port} as spectator...")
         game_sock.connect((SERVER_IP, game_port))
         print(f"✅ Connected to spectate room on port {game_port}!")
-        send_msg(game_sock, {"action": "spectate", "name": spectator_name})
+        send_msg(game_sock, {"action": "spectate", "name": spectator_name, "room": room_id,
+                             "format": SNAPSHOT_FORMAT})
     except Exception as e:
         print(f"❌ Failed to connect for spectating: {e}")
         pygame.quit()
@@ -679,6 +831,7 @@ def spectate_game(room_id, spectator_name):
     running = True
     frame_no = 0
     player_states = []
+    board_states = {}
 
     while running:
         for event in pygame.event.get():
@@ -690,12 +843,12 @@ def spectate_game(room_id, spectator_name):
         try:
             readable, _, _ = select.select([game_sock], [], [], 0)
             if readable:
-                msg = recv_msg(game_sock)
+                msg = recv_frame(game_sock)
                 if not msg:
                     print("Spectate connection closed by server.")
                     running = False
                     break
-                data = json.loads(msg)
+                data = parse_game_frame(msg, players)
                 if data.get('action') == 'game_over':
                     if data.get('aborted'):
                         print("Spectated match ended early (player disconnected).")
@@ -704,7 +857,7 @@ def spectate_game(room_id, spectator_name):
                     running = False
                 elif 'f' in data:
                     frame_no = data.get('f', frame_no)
-                    player_states = [(key, data[key]) for key in data if key != 'f']
+                    player_states = list(apply_snapshot(data, board_states).items())
         except ConnectionResetError:
             print("Spectate connection reset by server.")
             running = False
@@ -788,6 +941,10 @@ def main():
                     if msg:
                         try:
                             res = json.loads(msg)
+                            if 'event' in res:
+                                show_event(res)
+                                print("Enter 'invite' or 'start' (or 'quit'): ", end='', flush=True)
+                                continue
                             print(f"\n\nReceived message: {json.dumps(res, indent=2)}")
                             if res.get('action') == 'start':
                                 print("Game is starting! Launching GUI...")
@@ -816,7 +973,7 @@ def main():
                     result = room_op(sock, cmd)
                     if result > 0:
                         # Wait for the start message with room info
-                        msg = recv_msg(sock)
+                        msg = recv_reply(sock)
                         if msg:
                             try:
                                 res = json.loads(msg)
@@ -838,7 +995,7 @@ def main():
             if room_info and 'id' in room_info:
                 room_id = room_info.get('id', 0)
                 print(f"Room ID: {room_id}, connecting to game server...")
-                play_game(sock, room_id, username)
+                play_game(sock, room_id, username, (room_info.get('hostUser'), room_info.get('oppoUser')))
             else:
                 print("Error: No room information received for game start.")
 
@@ -851,7 +1008,7 @@ def main():
             if room_info and 'id' in room_info:
                 room_id = room_info.get('id', 0)
                 print(f"Room ID: {room_id}, connecting as spectator...")
-                spectate_game(room_id, username)
+                spectate_game(room_id, username, (room_info.get('hostUser'), room_info.get('oppoUser')))
             else:
                 print("Error: No room information received for spectating.")
 
@@ -0,0 +1,157 @@
+#include "data_client.h"
+#include "utility.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static mutex send_mu; // keeps frames from different threads from interleaving on the socket
+
+void DataClient::attach(int fd) {
+    fd_ = fd;
+    if (wake_fd_ < 0) wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) perror("[DataClient] eventfd");
+}
+
+// Match workers send requests too; their callbacks touch lobby state, so a failure is
+// handed to the dispatching thread rather than run on whichever thread hit it.
+void DataClient::fail_later(Callback cb) {
+    {
+        lock_guard<mutex> lk(mu_);
+        failed_.push_back(std::move(cb));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("[DataClient] eventfd write");
+}
+
+void DataClient::on_wake() {
+    uint64_t n;
+    while (read(wake_fd_, &n, sizeof(n)) > 0) {}
+    vector<Callback> failed;
+    {
+        lock_guard<mutex> lk(mu_);
+        failed.swap(failed_);
+    }
+    for (auto &cb : failed) cb(unavailable());
+}
+
+void DataClient::request(json req, Callback cb) {
+    uint64_t rid;
+    int fd;
+    {
+        lock_guard<mutex> lk(mu_);
+        fd = fd_;
+        if (fd < 0) rid = 0;
+        else {
+            rid = next_rid_++;
+            pending_.emplace(rid, std::move(cb));
+        }
+    }
+    if (rid == 0) return fail_later(std::move(cb));
+
+    req["rid"] = rid;
+    FrameWriter::Frame frame = FrameWriter::frame(req.dump()); // header and body in one write
+    bool ok;
+    {
+        lock_guard<mutex> lk(send_mu);
+        ok = write_fully(fd, frame->data(), frame->size());
+    }
+    if (ok) return;
+
+    cerr << "[DataClient] Failed to send request rid=" << rid << endl;
+    Callback failed;
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = pending_.find(rid);
+        if (it == pending_.end()) return; // already failed by fail_all()
+        failed = std::move(it->second);
+        pending_.erase(it);
+    }
+    fail_later(std::move(failed));
+}
+
+void DataClient::request_all(vector<json> reqs, function<void(vector<json>)> cb) {
+    struct Join {
+        vector<json> replies;
+        atomic<size_t> left;
+        function<void(vector<json>)> cb;
+    };
+    auto join = make_shared<Join>();
+    join->replies.resize(reqs.size());
+    join->left = reqs.size();
+    join->cb = std::move(cb);
+    if (reqs.empty()) {
+        join->cb({});
+        return;
+    }
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        request(std::move(reqs[i]), [join, i](json r) {
+            join->replies[i] = std::move(r);
+            if (--join->left == 0) join->cb(std::move(join->replies));
+        });
+    }
+}
+
+bool DataClient::on_readable() {
+    FrameReader::Status st = in_.fill(fd_);
+    string msg;
+    while (in_.next(msg)) dispatch(msg);
+    if (st != FrameReader::Open || in_.corrupt()) {
+        cerr << "[DataClient] Data server disconnected, failing " << in_flight() << " pending request(s)\n";
+        fail_all();
+        return false;
+    }
+    return true;
+}
+
+void DataClient::dispatch(const string &msg) {
+    json resp;
+    try {
+        resp = json::parse(msg);
+    } catch (const exception &e) {
+        cerr << "[DataClient] JSON parse error from data server: " << e.what() << "\nRaw: " << msg << endl;
+        return;
+    }
+
+    if (resp.contains("event")) {
+        if (event_cb_) event_cb_(std::move(resp));
+        return;
+    }
+
+    uint64_t rid = resp.value("rid", (uint64_t)0);
+    Callback cb;
+    {
+        lock_guard<mutex> lk(mu_);
+        auto it = pending_.find(rid);
+        if (it == pending_.end()) {
+            cerr << "[DataClient] Reply for unknown rid=" << rid << ": " << msg << endl;
+            return;
+        }
+        cb = std::move(it->second);
+        pending_.erase(it);
+    }
+    resp.erase("rid");
+    cb(std::move(resp));
+}
+
+size_t DataClient::in_flight() {
+    lock_guard<mutex> lk(mu_);
+    return pending_.size();
+}
+
+void DataClient::fail_all() {
+    vector<Callback> failed;
+    {
+        lock_guard<mutex> lk(mu_);
+        fd_ = -1;
+        for (auto &[rid, cb] : pending_) failed.push_back(std::move(cb));
+        pending_.clear();
+    }
+    for (auto &cb : failed) cb(unavailable());
+}
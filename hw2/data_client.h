@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "utility.h"
+
+using json = nlohmann::json;
+
+// Pipelined client for the data server connection.
+// Every request is tagged with a "rid" which the data server echoes back, so any
+// number of requests can be in flight at once and replies may arrive in any order.
+// Replies are dispatched from on_readable(), which the lobby epoll loop calls
+// whenever the data server socket is readable. Once subscribed, the data server also
+// sends change events (frames with an "event" key and no "rid"), handed to on_event().
+// Every callback runs on the dispatching thread, including the failed reply to a request
+// that could not be sent from another thread: that one is queued and signalled through
+// wake_fd(), which the lobby loop polls next to the data server socket.
+class DataClient {
+public:
+    using Callback = std::function<void(json)>;
+
+    // Also creates wake_fd(); call once, before the first request.
+    void attach(int fd);
+    int fd() const { return fd_; }
+    int wake_fd() const { return wake_fd_; }
+
+    // Send `req` and resume `cb` with the reply once it arrives (on the dispatching thread).
+    // If the request cannot be sent, `cb` gets a failed reply on the next on_wake().
+    void request(json req, Callback cb);
+
+    // Send all of `reqs` back to back and resume `cb` once every reply is in (same order as `reqs`).
+    void request_all(std::vector<json> reqs, std::function<void(std::vector<json>)> cb);
+
+    // Handler for change events; set before subscribing, runs on the dispatching thread.
+    void on_event(Callback cb) { event_cb_ = std::move(cb); }
+
+    // Read and dispatch every reply that has arrived. Returns false once the data server is gone.
+    bool on_readable();
+    // Run the callbacks of requests that failed before reaching the data server.
+    void on_wake();
+
+    size_t in_flight();
+
+    static json unavailable() { return {{"response", "failed"}, {"reason", "data server unavailable"}}; }
+
+private:
+    void fail_all();
+    void fail_later(Callback cb);
+    void dispatch(const std::string &msg);
+
+    int fd_ = -1;
+    int wake_fd_ = -1;
+    std::vector<Callback> failed_; // guarded by mu_, run by on_wake()
+    FrameReader in_;
+    uint64_t next_rid_ = 1;
+    std::mutex mu_;
+    std::unordered_map<uint64_t, Callback> pending_;
+    Callback event_cb_;
+};
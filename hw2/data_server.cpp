@@ -1,14 +1,24 @@
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <unordered_map>
 #include <string>
 #include <csignal>
+#include <cerrno>
+#include <memory>
+#include <optional>
+#include <set>
+#include <vector>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #include "utility.h"
+#include "records.h"
+#include "wal.h"
+#include "gamelog.h"
 #include "nlohmann/json.hpp"
 
 using json = nlohmann::json;
@@ -17,30 +27,64 @@ using namespace std;
 const int DATA_SERVER_PORT = 45631;
 const char *IP = "127.0.0.1";//140.113.17.11
 
-unordered_map<int, json> users;
-unordered_map<int, json> rooms;
+// ordered by id, so a search page starts at its cursor instead of walking every id ever issued
+map<int, User> users;
+map<int, Room> rooms;
+// name -> id, kept in step with users/rooms on every create, update and delete
+unordered_map<string, int> user_ids;
+unordered_map<string, int> room_ids;
 int user_cnt = 0;
 int room_cnt = 0;
-int sockfd;
 
-// --- Save and Load ---
-void saveUsers() {
-    json data = json::array();
-    for (auto &[id, user] : users) {
-        data.push_back(user);
-    }
-    ofstream out("data/users.json");
-    if (!out.is_open()) {
-        cerr << "[DataServer] Failed to open users.json for write\n";
-        return;
-    }
-    out << data.dump(4);
-    out.close();
-    cout << "[DataServer] Users saved.\n";
-}
+struct Options {
+    int fsync_ms = 0;              // 0: fsync every group commit, N: at most every N ms, -1: never
+    size_t snapshot_every = 10000; // log records between compacted snapshots
+} opt;
+unique_ptr<WriteAheadLog> wal; // data/wal-<n>.log + data/snapshot-<n>.dat
+unique_ptr<GameLogWriter> gamelogs; // data/gamelog.json
+
+// One game server connection. Its requests are applied in arrival order, interleaved
+// with those of every other game server, so all of them share one authoritative store.
+struct DataConn {
+    uint64_t gen = 0; // tells a reused fd apart from the connection a held reply belongs to
+    FrameReader in;
+    FrameWriter out{1024 * 1024, 64 * 1024 * 1024}; // replies are never droppable
+    bool subscribed = false; // sent "subscribe": gets every committed change as an event
+};
+unordered_map<int, DataConn> conns;
+uint64_t next_conn_gen = 1;
+
+// A reply and the connection it goes back to.
+struct Reply {
+    int fd;
+    uint64_t gen;
+    string msg;
+    json rid; // null when the request had none
+};
+// Replies to the requests of this wakeup, held until their log records are committed.
+vector<Reply> replies;
+// A reply held until the gamelog records it acknowledges are on disk.
+struct HeldReply {
+    int fd;
+    uint64_t gen;
+    json response;
+    int waiting = 0;
+    bool not_logged = false; // its wakeup's log commit failed, so it is answered as failed
+};
+unordered_map<uint64_t, HeldReply> held_replies;
+uint64_t next_hold = 0;
+vector<uint64_t> held_this_wakeup;
+// Set once a log commit fails: changes made since are not durable, so from then on every
+// create, update and delete is refused and the server only answers reads.
+bool log_broken = false;
+// gamelog record -> its held reply and its index in that reply's "results" (-1 for a plain create)
+unordered_map<GameLogWriter::Tag, pair<uint64_t, int>> gamelog_waits;
+GameLogWriter::Tag next_gamelog = 0;
 
-unordered_map<int, json> loadUsers(const string &filename) {
-    unordered_map<int, json> res;
+// --- Save and Load ---
+// Users from the users.json written by older versions, only read when there is no log yet.
+map<int, User> loadUsers(const string &filename) {
+    map<int, User> res;
     ifstream in(filename);
     if (!in.is_open()) {
         cerr << "[DataServer] No user file found, starting fresh.\n";
@@ -51,16 +95,14 @@ unordered_map<int, json> loadUsers(const string &filename) {
     try {
         in >> data;
         for (auto &u : data) {
-            int id = u.value("id", user_cnt);
-            json user = {
-                {"id", id},
-                {"name", u.value("name", "")},
-                {"password", u.value("password", "")},
-                {"last_login", u.value("last_login", now_time_str())},
-                {"status", "offline"},
-                {"roomName", "-1"}
-            };
-            res[id] = user;
+            User user;
+            user.id = u.value("id", user_cnt);
+            user.last_login = now_time_str();
+            apply_json(user, u);
+            user.status = User::Offline;
+            user.roomName = "-1";
+            res[user.id] = user;
+            int id = user.id;
             user_cnt = max(user_cnt, id + 1);
         }
     } catch (...) {
@@ -69,62 +111,230 @@ unordered_map<int, json> loadUsers(const string &filename) {
     return res;
 }
 
-// --- Core Operations ---
-json normalize_user(json data) {
-    return {
-        {"id", data.value("id", -1)},
-        {"name", data.value("name", "")},
-        {"password", data.value("password", "")},
-        {"last_login", data.value("last_login", now_time_str())},
-        {"status", data.value("status", "idle")},
-        {"roomName", data.value("roomName", "-1")}
-    };
+// --- Name indexes ---
+// Move `id` from name `from` to name `to` (either may be empty for create / delete).
+void reindex(unordered_map<string, int> &index, const string &from, const string &to, int id) {
+    if (from == to) return;
+    auto it = index.find(from);
+    if (it != index.end() && it->second == id) index.erase(it);
+    if (!to.empty()) index.emplace(to, id);
 }
 
-json normalize_room(json data) {
-    // Validate and clamp difficulty to range [2, 10]
-    int difficulty = data.value("difficulty", 10);
-    if (difficulty < 2) difficulty = 2;
-    if (difficulty > 10) difficulty = 10;
-
-    return {
-        {"id", data.value("id", -1)},
-        {"name", data.value("name", "")},
-        {"hostUser", data.value("hostUser", "")},
-        {"oppoUser", data.value("oppoUser", "")},
-        {"visibility", data.value("visibility", "public")},
-        {"inviteList", data.value("inviteList", json::array())},
-        {"specList", data.value("specList", json::array())},
-        {"status", data.value("status", "idle")},
-        {"difficulty", difficulty}
-    };
+// Entry named `name` in `table` through its index, nullptr if there is none.
+template <class T>
+T *find_by_name(map<int, T> &table, const unordered_map<string, int> &index, const string &name) {
+    auto it = index.find(name);
+    if (it == index.end()) return nullptr;
+    auto row = table.find(it->second);
+    return row == table.end() ? nullptr : &row->second;
+}
+
+// --- Invite index ---
+// user id -> ids of the rooms whose inviteList holds it, so a user's invites cost
+// O(invites) to list instead of a scan of every room
+unordered_map<int, set<int>> invites;
+
+// Move room `id` from the invite lists of `before` to those of `after` (either may be null).
+void index_invites(int id, const Room *before, const Room *after) {
+    if (before) {
+        for (int uid : before->inviteList) {
+            if (after && after->inviteList.contains(uid)) continue;
+            auto it = invites.find(uid);
+            if (it == invites.end()) continue;
+            it->second.erase(id);
+            if (it->second.empty()) invites.erase(it);
+        }
+    }
+    if (after)
+        for (int uid : after->inviteList) invites[uid].insert(id);
+}
+void index_invites(int, const User *, const User *) {} // users hold no invites
+
+// --- Change events ---
+// Subscribed game servers get each committed change as an unsolicited {"event": ...}
+// frame without a "rid", so they can push it to their lobby clients instead of having
+// those poll. Events of one wakeup go out after its group commit, like the replies.
+// Each event carries a "seq" and each reply the last seq issued when it was produced,
+// so a subscriber can tell an event that predates one of its own writes.
+size_t subscribers = 0;
+vector<string> events;
+uint64_t event_seq = 0;
+
+void publish(json ev) {
+    if (subscribers == 0) return;
+    ev["seq"] = ++event_seq;
+    events.push_back(ev.dump());
+}
+
+// What other players may see of a user.
+json user_view(const User &u) {
+    json j = to_json(u);
+    j.erase("password");
+    j.erase("last_login");
+    return j;
 }
 
+// A room was created or updated: the room itself, then one invite event per user
+// that was not on its inviteList before.
+void publish_room(const char *op, const Room *before, const Room &after) {
+    if (subscribers == 0) return;
+    json data = to_json(after);
+    publish({{"event", "room"}, {"op", op}, {"data", data}});
+    for (int uid : after.inviteList)
+        if (!before || !before->inviteList.contains(uid)) publish({{"event", "invite"}, {"user", uid}, {"data", data}});
+}
+
+// --- Persistence ---
+// Every create / update logs the record as it is afterwards, so replay just puts it back.
+void log_op(const char *op, const char *type, const json &data) {
+    wal->append(json{{"op", op}, {"type", type}, {"data", data}}.dump());
+}
+
+template <class T>
+void put_record(map<int, T> &table, unordered_map<string, int> &index, int &cnt, const json &data) {
+    T rec;
+    apply_json(rec, data);
+    rec.id = data.at("id").get<int>();
+    auto it = table.find(rec.id);
+    reindex(index, it == table.end() ? "" : it->second.name, rec.name, rec.id);
+    index_invites(rec.id, it == table.end() ? nullptr : &it->second, &rec);
+    cnt = max(cnt, rec.id + 1);
+    table[rec.id] = std::move(rec);
+}
+
+void replay_op(const string &payload) {
+    json e = json::parse(payload);
+    string op = e.value("op", ""), type = e.value("type", "");
+    const json &data = e["data"];
+    if (op == "delete") {
+        int id = data.at("id").get<int>();
+        auto it = rooms.find(id);
+        if (type == "room" && it != rooms.end()) {
+            reindex(room_ids, it->second.name, "", id);
+            index_invites(id, &it->second, nullptr);
+            rooms.erase(it);
+        }
+    } else if (type == "user") {
+        put_record(users, user_ids, user_cnt, data);
+    } else if (type == "room") {
+        put_record(rooms, room_ids, room_cnt, data);
+    }
+}
+
+void load_snapshot(const string &body) {
+    json snap = json::parse(body);
+    for (auto &u : snap["users"]) put_record(users, user_ids, user_cnt, u);
+    for (auto &r : snap["rooms"]) put_record(rooms, room_ids, room_cnt, r);
+    // ids are never reused, even those of rooms deleted before the snapshot
+    user_cnt = max(user_cnt, snap.value("user_cnt", 0));
+    room_cnt = max(room_cnt, snap.value("room_cnt", 0));
+}
+
+// Copies the tables now, serializes them on the WAL's snapshot thread.
+void take_snapshot() {
+    wal->snapshot([u = users, r = rooms, uc = user_cnt, rc = room_cnt] {
+        json snap = {{"v", 1}, {"user_cnt", uc}, {"room_cnt", rc}, {"users", json::array()}, {"rooms", json::array()}};
+        for (auto &[id, user] : u) snap["users"].push_back(to_json(user));
+        for (auto &[id, room] : r) snap["rooms"].push_back(to_json(room));
+        return snap.dump();
+    });
+}
+
+// Nobody is connected after a restart and no match survives one; rooms and their
+// members stay, as they do when everyone logs out.
+void reset_sessions() {
+    for (auto &[id, user] : users) {
+        if (user.status == User::Spectating || !find_by_name(rooms, room_ids, user.roomName)) user.roomName = "-1";
+        user.status = User::Offline;
+    }
+    for (auto &[id, room] : rooms) {
+        room.status = Room::Idle;
+        room.specList.clear();
+    }
+}
+
+// --- Undo log ---
+// While an atomic batch runs, every record is saved before its first change (nullopt:
+// it did not exist yet), so a failed batch can put both tables back as they were.
+bool undo_active = false;
+vector<pair<int, optional<User>>> undo_users;
+vector<pair<int, optional<Room>>> undo_rooms;
+
+template <class T>
+void remember(vector<pair<int, optional<T>>> &undo, const map<int, T> &table, int id) {
+    if (!undo_active) return;
+    auto it = table.find(id);
+    undo.emplace_back(id, it == table.end() ? nullopt : optional<T>(it->second));
+}
+
+template <class T>
+void restore(vector<pair<int, optional<T>>> &undo, map<int, T> &table, unordered_map<string, int> &index) {
+    for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+        auto &[id, old] = *it;
+        auto cur = table.find(id);
+        string name = cur == table.end() ? "" : cur->second.name;
+        reindex(index, name, old ? old->name : "", id);
+        index_invites(id, cur == table.end() ? nullptr : &cur->second, old ? &*old : nullptr);
+        if (old) table[id] = *old;
+        else if (cur != table.end()) table.erase(cur);
+    }
+    undo.clear();
+}
+
+// --- Core Operations ---
+const int NAME_TAKEN = -2;
+
+// Id of the new record. Names are unique per type, and checking them here rather than
+// in the game server keeps two pipelined creates of one name from both succeeding.
 int op_create(const string &type, json data) {
     if (type == "user") {
-        json u = normalize_user(data);
-        u["id"] = user_cnt++;
-        users[u["id"]] = u;
-        return u["id"];
+        User u;
+        u.last_login = now_time_str();
+        apply_json(u, data);
+        if (!u.name.empty() && user_ids.count(u.name)) return NAME_TAKEN;
+        u.id = user_cnt++;
+        reindex(user_ids, "", u.name, u.id);
+        log_op("create", "user", to_json(u));
+        remember(undo_users, users, u.id);
+        users[u.id] = std::move(u);
+        return user_cnt - 1;
     } else if (type == "room") {
-        json r = normalize_room(data);
-        r["id"] = room_cnt++;
-        rooms[r["id"]] = r;
-        cerr << "[DataServer] Created room: " << r.value("name", "(unnamed)")
-             << " (id=" << r["id"] << ", host=" << r.value("hostUser", "(unknown)")
-             << ", visibility=" << r.value("visibility", "public") << ")" << endl;
-        return r["id"];
-    } else if (type == "gamelog") {
-        ofstream out("data/gamelog.json", ios::app);
-        if (!out.is_open()) return -1;
-        out << data.dump() << endl;
-        return 1;
+        Room r;
+        apply_json(r, data);
+        if (!r.name.empty() && room_ids.count(r.name)) return NAME_TAKEN;
+        r.id = room_cnt++;
+        reindex(room_ids, "", r.name, r.id);
+        index_invites(r.id, nullptr, &r);
+        log_op("create", "room", to_json(r));
+        publish_room("create", nullptr, r);
+        remember(undo_rooms, rooms, r.id);
+        cerr << "[DataServer] Created room: " << (r.name.empty() ? "(unnamed)" : r.name)
+             << " (id=" << r.id << ", host=" << (r.hostUser.empty() ? "(unknown)" : r.hostUser)
+             << ", visibility=" << (r.visibility == Room::Public ? "public" : "private") << ")" << endl;
+        rooms[r.id] = std::move(r);
+        return room_cnt - 1;
     }
     return -1;
 }
 
+json op_search(const string &type, const json &request);
+
 json op_query(const string &type, const json &request) {
     json res;
+    if (type == "invites") {
+        // rooms inviting the user given by "id" or "name", paged like search
+        int uid = request.value("id", -1);
+        if (uid < 0) {
+            User *u = find_by_name(users, user_ids, request.value("name", ""));
+            if (!u) return {{"response", "failed"}, {"reason", "no such user"}};
+            uid = u->id;
+        }
+        json search = request;
+        search["filter"] = {{"invited", uid}};
+        res = op_search("room", search);
+        if (res["response"] == "failed") res["reason"] = "no invites";
+        return res;
+    }
     if (!(type == "user" || type=="room")) {
         res["response"] = "failed";
         res["reason"] = "unsupported type";
@@ -139,18 +349,16 @@ json op_query(const string &type, const json &request) {
     if (type == "user") {
         if (id >= 0 && users.count(id)) {
             res["response"] = "success";
-            res["data"] = users[id];
+            res["data"] = to_json(users[id]);
             // cerr<<"response with id, data:"<<res.dump()<<endl;
             return res;
         }
 
         if (!name.empty()) {
-            for (auto &[uid, user] : users) {
-                if (user.value("name", "") == name) {
-                    res["response"] = "success";
-                    res["data"] = user;
-                    return res;
-                }
+            if (User *user = find_by_name(users, user_ids, name)) {
+                res["response"] = "success";
+                res["data"] = to_json(*user);
+                return res;
             }
         }
 
@@ -160,19 +368,17 @@ json op_query(const string &type, const json &request) {
     } else if (type == "room") {
         if (id >= 0 && rooms.count(id)) {
             res["response"] = "success";
-            res["data"] = rooms[id];
-            cerr << "[DataServer] Queried room by id=" << id << ": " << rooms[id].value("name", "(unnamed)") << endl;
+            res["data"] = to_json(rooms[id]);
+            cerr << "[DataServer] Queried room by id=" << id << ": " << rooms[id].name << endl;
             return res;
         }
 
         if (!name.empty()) {
-            for (auto &[rid, room] : rooms) {
-                if (room.value("name", "") == name) {
-                    res["response"] = "success";
-                    res["data"] = room;
-                    cerr << "[DataServer] Queried room by name='" << name << "' (id=" << room.value("id", -1) << ")" << endl;
-                    return res;
-                }
+            if (Room *room = find_by_name(rooms, room_ids, name)) {
+                res["response"] = "success";
+                res["data"] = to_json(*room);
+                cerr << "[DataServer] Queried room by name='" << name << "' (id=" << room->id << ")" << endl;
+                return res;
             }
         }
 
@@ -187,27 +393,85 @@ json op_query(const string &type, const json &request) {
     return res;
 }
 
-json op_search(const string &type) {
-    json arr = json::array(), res;
+// Largest page search will return; a page also stops before its JSON passes the byte
+// budget, so a reply always fits in one frame.
+const int SEARCH_DEFAULT_LIMIT = 50, SEARCH_MAX_LIMIT = 200;
+const size_t SEARCH_REPLY_BUDGET = MAX_FRAME_LEN / 2;
+
+// Candidate ids for search_page(): the first one >= `from`, -1 past the last. Either a
+// whole table (live records only, whatever the id counter reached) or an index set.
+static int id_of(int id) { return id; }
+template <class T>
+static int id_of(const pair<const int, T> &entry) { return entry.first; }
+
+template <class Sorted>
+auto ids_in(const Sorted &ids) {
+    return [&ids](int from) {
+        auto it = ids.lower_bound(from);
+        return it == ids.end() ? -1 : id_of(*it);
+    };
+}
+
+// One page of the candidate records matching `pred`, in id order from request["cursor"].
+// "next" is the cursor of the following page and is only present when another match exists.
+template <class T, class Ids, class Pred>
+json search_page(const map<int, T> &table, Ids next_id, const json &request, Pred pred) {
+    int limit = min(SEARCH_MAX_LIMIT, max(1, request.value("limit", SEARCH_DEFAULT_LIMIT)));
+    int cursor = max(0, request.value("cursor", 0));
+    json arr = json::array(), res = {{"response", "success"}};
+    size_t bytes = 0;
+    for (int id = next_id(cursor); id >= 0; id = next_id(id + 1)) {
+        auto it = table.find(id);
+        if (it == table.end() || !pred(it->second)) continue;
+        json item = to_json(it->second);
+        size_t size = item.dump().size();
+        if ((int)arr.size() == limit || (!arr.empty() && bytes + size > SEARCH_REPLY_BUDGET)) {
+            res["next"] = id;
+            break;
+        }
+        bytes += size;
+        arr.push_back(std::move(item));
+    }
+    res["data"] = std::move(arr);
+    return res;
+}
+
+// request["filter"] for users: "status" (idle unless a filter is given);
+// for rooms: "visibility", "status", "host" and "invited" (a user id in inviteList).
+json op_search(const string &type, const json &request) {
+    json filter = request.value("filter", json::object()), res;
+    if (!filter.is_object()) return {{"response", "failed"}, {"reason", "filter must be an object"}};
     if (type == "user") {
-        for (auto &[id, user] : users)
-            if (user.value("status", "") == "idle")
-                arr.push_back(user);
-        res["response"] = arr.empty() ? "failed" : "success";
-        if (arr.empty()) {
-            res["reason"] = "no user online";
+        optional<User::Status> status = User::Idle;
+        if (request.contains("filter")) status.reset();
+        if (filter.contains("status") && !parse_enum(filter["status"].get<string>(), status.emplace()))
+            return {{"response", "failed"}, {"reason", "unknown status"}};
+        res = search_page(users, ids_in(users), request, [&](const User &u) { return !status || u.status == *status; });
+        if (res["data"].empty()) res = {{"response", "failed"}, {"reason", "no user online"}};
+    } else if (type == "room") {
+        optional<Room::Visibility> vis;
+        optional<Room::Status> status;
+        if (filter.contains("visibility") && !parse_enum(filter["visibility"].get<string>(), vis.emplace()))
+            return {{"response", "failed"}, {"reason", "unknown visibility"}};
+        if (filter.contains("status") && !parse_enum(filter["status"].get<string>(), status.emplace()))
+            return {{"response", "failed"}, {"reason", "unknown status"}};
+        optional<string> host;
+        if (filter.contains("host")) host = filter["host"].get<string>();
+        auto pred = [&](const Room &r) {
+            return (!vis || r.visibility == *vis) && (!status || r.status == *status) && (!host || r.hostUser == *host);
+        };
+        if (filter.contains("invited")) {
+            static const set<int> none;
+            auto it = invites.find(filter["invited"].get<int>());
+            res = search_page(rooms, ids_in(it == invites.end() ? none : it->second), request, pred);
         } else {
-            res["data"] = arr;
+            res = search_page(rooms, ids_in(rooms), request, pred);
         }
-    } else if (type == "room") {
-        for (auto &[id, room] : rooms) arr.push_back(room);
-        res["response"] = arr.empty() ? "failed" : "success";
-        if (arr.empty()) {
-            res["reason"] = "no available room";
-            cerr << "[DataServer] Search rooms: no rooms available, either public or private" << endl;
+        if (res["data"].empty()) {
+            res = {{"response", "failed"}, {"reason", "no available room"}};
+            cerr << "[DataServer] Search rooms: no rooms match " << filter.dump() << endl;
         } else {
-            res["data"] = arr;
-            cerr << "[DataServer] Search rooms: found " << arr.size() << " public room(s)" << endl;
+            cerr << "[DataServer] Search rooms: found " << res["data"].size() << " room(s) matching " << filter.dump() << endl;
         }
     } else {
         res["response"] = "failed";
@@ -232,17 +496,27 @@ int op_update(const string &type, json data) {
     }
 
     if (type == "user" && users.count(id)) {
-        json merged = users[id];
-        for (auto &[k, v] : data.items()) merged[k] = v;
-        users[id] = normalize_user(merged);
-        cout << "[DataServer] Updated user id=" << id << " status=" << users[id]["status"] << endl;
+        User updated = users[id]; // a mistyped field throws before anything changes
+        apply_json(updated, data);
+        if (updated.status != users[id].status || updated.roomName != users[id].roomName)
+            publish({{"event", "user"}, {"op", "update"}, {"data", user_view(updated)}});
+        remember(undo_users, users, id);
+        reindex(user_ids, users[id].name, updated.name, id);
+        users[id] = std::move(updated);
+        log_op("update", "user", to_json(users[id]));
+        cout << "[DataServer] Updated user id=" << id << " status=" << to_json(users[id])["status"] << endl;
         return 1;
     } else if (type == "room" && rooms.count(id)) {
-        json merged = rooms[id];
-        for (auto &[k, v] : data.items()) merged[k] = v;
-        rooms[id] = normalize_room(merged);
-        cerr << "[DataServer] Updated room id=" << id << " (" << rooms[id].value("name", "(unnamed)")
-             << ", status=" << rooms[id].value("status", "idle") << ")" << endl;
+        Room updated = rooms[id];
+        apply_json(updated, data);
+        remember(undo_rooms, rooms, id);
+        reindex(room_ids, rooms[id].name, updated.name, id);
+        index_invites(id, &rooms[id], &updated);
+        publish_room("update", &rooms[id], updated);
+        rooms[id] = std::move(updated);
+        log_op("update", "room", to_json(rooms[id]));
+        cerr << "[DataServer] Updated room id=" << id << " (" << rooms[id].name
+             << ", status=" << (rooms[id].status == Room::Playing ? "playing" : "idle") << ")" << endl;
         return 1;
     }
 
@@ -253,36 +527,299 @@ int op_update(const string &type, json data) {
 
 int op_delete(const string &type, const string &name) {
     if (type == "room") {
-        for (auto it = rooms.begin(); it != rooms.end(); ++it) {
-            if (it->second.value("name", "") == name) {
-                cerr << "[DataServer] Deleted room: " << name << " (id=" << it->first << ")" << endl;
-                rooms.erase(it);
-                return 1;
-            }
+        if (Room *room = find_by_name(rooms, room_ids, name)) {
+            int id = room->id;
+            cerr << "[DataServer] Deleted room: " << name << " (id=" << id << ")" << endl;
+            remember(undo_rooms, rooms, id);
+            reindex(room_ids, name, "", id);
+            index_invites(id, room, nullptr);
+            publish({{"event", "room"}, {"op", "delete"},
+                     {"data", {{"id", id}, {"name", name}, {"visibility", room->visibility == Room::Public ? "public" : "private"}}}});
+            rooms.erase(id);
+            log_op("delete", "room", {{"id", id}});
+            return 1;
         }
         cerr << "[DataServer] Delete room failed: '" << name << "' not found" << endl;
     }
     return -1;
 }
 
-// --- Signal handler ---
-void signal_handler(int) {
-    cout << "\n[DataServer] Caught SIGINT, saving users and exiting.\n";
-    saveUsers();
-    close(sockfd);
-    exit(0);
+// --- Connections ---
+vector<int> unflushed; // connections with frames queued during this wakeup
+
+// Queued, not written: commit_replies() flushes each connection once per wakeup, so a
+// reply and the events it caused leave in one sendmsg.
+void send_reply(int fd, uint64_t gen, const FrameWriter::Frame &msg) {
+    auto it = conns.find(fd);
+    if (it == conns.end() || it->second.gen != gen) return; // that game server is gone
+    bool was_idle = it->second.out.idle();
+    FrameWriter::Result r = it->second.out.queue(msg);
+    if (r == FrameWriter::Overflow || r == FrameWriter::Failed) {
+        cerr << "[DataServer] Game server fd=" << fd << " is not reading its replies, disconnecting\n";
+        shutdown(fd, SHUT_RDWR);
+    } else if (was_idle) {
+        unflushed.push_back(fd);
+    }
+}
+
+void flush_replies() {
+    for (int fd : unflushed) {
+        auto it = conns.find(fd);
+        if (it != conns.end() && !it->second.out.flush(fd)) shutdown(fd, SHUT_RDWR);
+    }
+    unflushed.clear();
+}
+void send_reply(int fd, uint64_t gen, const string &msg) { send_reply(fd, gen, FrameWriter::frame(msg)); }
+
+// Apply one request. A gamelog create is not written here: its line is left in
+// `gamelog` and the caller decides when to hand it to the writer.
+json run_op(const json &request, string &gamelog) {
+    string action = request.value("action", "");
+    string type = request.value("type", "");
+    json response;
+    if (log_broken && (action == "update" || action == "delete" || (action == "create" && type != "gamelog")))
+        return {{"response", "failed"}, {"reason", "log unavailable"}};
+
+    try {
+        if (action == "create") {
+            json data = request["data"].is_string() ? json::parse(request["data"].get<string>()) : request["data"];
+            if (type == "gamelog") {
+                gamelog = data.dump();
+                return {{"response", "success"}};
+            }
+            int result = op_create(type, data);
+            response["response"] = result >= 0 ? "success" : "failed";
+            if (result >= 0) response["id"] = result;
+            if (result < 0) response["reason"] = result == NAME_TAKEN ? "name taken" : "create failed";
+        }
+        else if (action == "query") {
+            response = op_query(type, request);
+        }
+        else if (action == "search") {
+            response = op_search(type, request);
+        }
+        else if (action == "update") {
+            json data = request["data"].is_string() ? json::parse(request["data"].get<string>()) : request["data"];
+            int result = op_update(type, data);
+            response["response"] = result > 0 ? "success" : "failed";
+            if (result <= 0) response["reason"] = "update failed";
+        }
+        else if (action == "delete") {
+            string name = request["data"].is_string() ? request["data"].get<string>() : "";
+            int result = op_delete(type, name);
+            response["response"] = result > 0 ? "success" : "failed";
+            if (result <= 0) response["reason"] = request.dump();
+        }
+        else {
+            response["response"] = "failed";
+            response["reason"] = "unknown action";
+        }
+    } catch (const exception &e) {
+        cerr << "[DataServer] Exception in action handler: " << e.what() << endl;
+        response = {{"response", "failed"}, {"reason", e.what()}};
+    }
+    return response;
+}
+
+// Run request["ops"] in order, collecting every result in "results". With "atomic" the
+// first failure undoes the batch's earlier changes (tables, log and events) and stops;
+// its gamelogs are only written once every operation has succeeded.
+json run_batch(const json &request, vector<pair<int, string>> &gamelog_lines) {
+    if (!request.contains("ops") || !request["ops"].is_array())
+        return {{"response", "failed"}, {"reason", "ops must be an array"}};
+    bool atomic = request.value("atomic", false);
+    WriteAheadLog::Mark mark = wal->mark();
+    size_t events_mark = events.size();
+    undo_active = atomic;
+
+    json results = json::array();
+    int failed_at = -1;
+    for (auto &op : request["ops"]) {
+        json r;
+        string line;
+        if (!op.is_object() || op.value("action", "") == "batch") r = {{"response", "failed"}, {"reason", "not an operation"}};
+        else r = run_op(op, line);
+        if (!line.empty()) gamelog_lines.emplace_back(static_cast<int>(results.size()), std::move(line));
+        bool ok = r.value("response", "failed") == "success";
+        results.push_back(std::move(r));
+        if (!ok && failed_at < 0) failed_at = static_cast<int>(results.size()) - 1;
+        if (!ok && atomic) break;
+    }
+
+    undo_active = false;
+    json response = {{"response", failed_at < 0 ? "success" : "failed"}};
+    if (atomic && failed_at >= 0) {
+        restore(undo_users, users, user_ids);
+        restore(undo_rooms, rooms, room_ids);
+        wal->rollback(mark);
+        events.resize(events_mark);
+        gamelog_lines.clear();
+        response["reason"] = "operation " + to_string(failed_at) + " failed, nothing was applied";
+        cerr << "[DataServer] Atomic batch rolled back at operation " << failed_at << endl;
+    } else {
+        undo_users.clear();
+        undo_rooms.clear();
+    }
+    if (failed_at >= 0) response["failed"] = failed_at;
+    response["results"] = std::move(results);
+    return response;
 }
 
+void handle_request(int fd, uint64_t gen, const string &msg) {
+    // cerr<<msg<<endl;
+    json request;
+    try {
+        request = json::parse(msg);
+    } catch (const exception &e) {
+        cerr << "[DataServer] Invalid JSON: " << e.what() << "\nRaw: " << msg << endl;
+        return;
+    }
+
+    vector<pair<int, string>> gamelog_lines; // (index in "results", or -1) -> line to write
+    json response;
+    if (request.value("action", "") == "subscribe") {
+        DataConn &c = conns[fd];
+        if (!c.subscribed) {
+            c.subscribed = true;
+            ++subscribers;
+            cout << "[DataServer] Game server fd=" << fd << " subscribed to change events\n";
+        }
+        response = {{"response", "success"}};
+    } else if (request.value("action", "") == "batch") {
+        response = run_batch(request, gamelog_lines);
+    } else {
+        string line;
+        response = run_op(request, line);
+        if (!line.empty()) gamelog_lines.emplace_back(-1, std::move(line));
+    }
+    if (request.contains("rid")) response["rid"] = request["rid"]; // lets the game server pipeline requests
+    if (subscribers > 0) response["seq"] = event_seq;
+
+    if (gamelog_lines.empty()) {
+        replies.push_back({fd, gen, response.dump(), request.value("rid", json())});
+        return;
+    }
+    // answered from answer_gamelogs() once every line is on disk
+    uint64_t hold = next_hold++;
+    held_this_wakeup.push_back(hold);
+    held_replies[hold] = {fd, gen, std::move(response), static_cast<int>(gamelog_lines.size())};
+    for (auto &[index, line] : gamelog_lines) {
+        gamelog_waits[next_gamelog] = {hold, index};
+        gamelogs->submit(std::move(line), next_gamelog++);
+    }
+}
+
+// Group commit: one log write (and fsync) for every change made during this wakeup,
+// then the replies that depend on it and the events describing it, each event framed
+// once for every subscriber, and everything queued for a connection sent in one go.
+// If the commit fails, nothing of this wakeup is acknowledged: its replies fail, its events
+// are dropped and the server stops taking changes (see log_broken).
+void commit_replies() {
+    bool durable = wal->commit();
+    if (!durable) {
+        if (!log_broken) cerr << "[DataServer] Log commit failed, refusing changes from now on\n";
+        log_broken = true;
+        events.clear();
+        for (uint64_t hold : held_this_wakeup) {
+            auto it = held_replies.find(hold);
+            if (it != held_replies.end()) it->second.not_logged = true;
+        }
+    }
+    held_this_wakeup.clear();
+    for (auto &r : replies) {
+        if (durable) {
+            send_reply(r.fd, r.gen, r.msg);
+            continue;
+        }
+        json failed = {{"response", "failed"}, {"reason", "log write failed"}};
+        if (!r.rid.is_null()) failed["rid"] = r.rid;
+        send_reply(r.fd, r.gen, failed.dump());
+    }
+    replies.clear();
+    for (auto &e : events) {
+        FrameWriter::Frame f = FrameWriter::frame(e);
+        for (auto &[fd, c] : conns)
+            if (c.subscribed) send_reply(fd, c.gen, f);
+    }
+    events.clear();
+    flush_replies();
+    if (wal->records_since_snapshot() >= opt.snapshot_every) take_snapshot();
+}
+
+void answer_gamelogs() {
+    for (auto [tag, ok] : gamelogs->completed()) {
+        auto wait = gamelog_waits.find(tag);
+        if (wait == gamelog_waits.end()) continue;
+        auto [hold, index] = wait->second;
+        gamelog_waits.erase(wait);
+        HeldReply &h = held_replies[hold];
+        if (!ok) {
+            json failed = {{"response", "failed"}, {"reason", "gamelog write failed"}};
+            if (index < 0) {
+                if (h.response.contains("rid")) failed["rid"] = h.response["rid"];
+                h.response = failed;
+            } else {
+                h.response["results"][index] = failed;
+                h.response["response"] = "failed";
+            }
+        }
+        if (--h.waiting > 0) continue;
+        if (h.not_logged) {
+            json failed = {{"response", "failed"}, {"reason", "log write failed"}};
+            if (h.response.contains("rid")) failed["rid"] = h.response["rid"];
+            h.response = failed;
+        }
+        send_reply(h.fd, h.gen, h.response.dump());
+        held_replies.erase(hold);
+    }
+}
+
+// --- Signal handler ---
+// Only sets a flag: the main loop notices it when epoll_pwait returns EINTR and shuts down
+// from there, since snapshotting and closing files is not async-signal-safe.
+volatile sig_atomic_t stop_requested = 0;
+void signal_handler(int) { stop_requested = 1; }
+
 // --- Main server loop ---
-int main() {
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string k = argv[i], v = argv[i + 1];
+        if (k == "--fsync") opt.fsync_ms = stoi(v);
+        else if (k == "--snapshot-every") opt.snapshot_every = max(1, stoi(v));
+        else {
+            cerr << "[DataServer] Unknown option " << k << endl;
+            return 2;
+        }
+    }
+
     signal(SIGINT, signal_handler);
-    users = loadUsers("data/users.json");
+    // SIGINT stays blocked except inside epoll_pwait, so it cannot slip in between the
+    // loop's check of stop_requested and the wait; threads started below inherit the block
+    sigset_t block, wait_mask;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigprocmask(SIG_BLOCK, &block, &wait_mask);
+
+    wal = make_unique<WriteAheadLog>("data", opt.fsync_ms);
+    if (!wal->recover(load_snapshot, replay_op)) return 1;
+    if (users.empty() && rooms.empty()) {
+        users = loadUsers("data/users.json");
+        for (auto &[id, user] : users) reindex(user_ids, "", user.name, id);
+        if (!users.empty()) take_snapshot(); // imported once, the log owns them from now on
+    }
+    reset_sessions();
+    gamelogs = make_unique<GameLogWriter>("data/gamelog.json", 4096, opt.fsync_ms >= 0);
+    if (!gamelogs->open()) return 1;
+    cout << "[DataServer] Loaded " << users.size() << " user(s) and " << rooms.size() << " room(s)\n";
+    signal(SIGPIPE, SIG_IGN);
 
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_fd < 0) {
         perror("socket");
         return 1;
     }
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
@@ -295,76 +832,71 @@ int main() {
     }
 
     listen(listen_fd, SOMAXCONN);
+    make_socket_non_blocking(listen_fd);
     cout << "[DataServer] Listening on " << IP << ":" << DATA_SERVER_PORT << " ...\n";
 
-    sockaddr_in client{};
-    socklen_t len = sizeof(client);
-    sockfd = accept(listen_fd, (sockaddr *)&client, &len);
-    if (sockfd < 0) {
-        perror("accept");
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    epoll_event lev{.events = EPOLLIN, .data = {.fd = listen_fd}};
+    epoll_event gev{.events = EPOLLIN, .data = {.fd = gamelogs->event_fd()}};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &lev) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, gamelogs->event_fd(), &gev) < 0) {
+        perror("epoll_ctl");
         return 1;
     }
-    cout << "[DataServer] Connected to game server.\n";
-    close(listen_fd);
 
-    while (true) {
-        string msg = recv_message(sockfd);
-        if (msg.empty() || msg == "Disconnected") {
-            cout << "[DataServer] Game server disconnected.\n";
+    const int MAX_EVENTS = 64;
+    epoll_event evs[MAX_EVENTS];
+    while (!stop_requested) {
+        int n = epoll_pwait(epfd, evs, MAX_EVENTS, -1, &wait_mask);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             break;
         }
-        // cerr<<msg<<endl;
-        json request;
-        try {
-            request = json::parse(msg);
-        } catch (const exception &e) {
-            cerr << "[DataServer] Invalid JSON: " << e.what() << "\nRaw: " << msg << endl;
-            continue;
-        }
-
-        string action = request.value("action", "");
-        string type = request.value("type", "");
-        json response;
-
-        try {
-            if (action == "create") {
-                json data = request["data"].is_string() ? json::parse(request["data"].get<string>()) : request["data"];
-                int result = op_create(type, data);
-                response["response"] = result >= 0 ? "success" : "failed";
-                if (result >= 0) response["id"] = result;
-                if (result < 0) response["reason"] = "create failed";
-            }
-            else if (action == "query") {
-                response = op_query(type, request);
-            }
-            else if (action == "search") {
-                response = op_search(type);
-            }
-            else if (action == "update") {
-                json data = request["data"].is_string() ? json::parse(request["data"].get<string>()) : request["data"];
-                int result = op_update(type, data);
-                response["response"] = result > 0 ? "success" : "failed";
-                if (result <= 0) response["reason"] = "update failed";
-            }
-            else if (action == "delete") {
-                string name = request["data"].is_string() ? request["data"].get<string>() : "";
-                int result = op_delete(type, name);
-                response["response"] = result > 0 ? "success" : "failed";
-                if (result <= 0) response["reason"] = request.dump();
-            }
-            else {
-                response["response"] = "failed";
-                response["reason"] = "unknown action";
+        for (int i = 0; i < n; ++i) {
+            int fd = evs[i].data.fd;
+            if (fd == listen_fd) {
+                while (true) {
+                    int cs = accept(listen_fd, nullptr, nullptr);
+                    if (cs < 0) break;
+                    make_socket_non_blocking(cs);
+                    set_no_delay(cs); // replies and events are small frames
+                    epoll_event ce{.events = EPOLLIN | EPOLLOUT | EPOLLET, .data = {.fd = cs}};
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, cs, &ce);
+                    conns[cs].gen = next_conn_gen++;
+                    cout << "[DataServer] Game server connected (fd=" << cs << ", " << conns.size() << " connected)\n";
+                }
+            } else if (fd == gamelogs->event_fd()) {
+                answer_gamelogs();
+            } else {
+                auto it = conns.find(fd);
+                if (it == conns.end()) continue;
+                if (evs[i].events & EPOLLOUT) it->second.out.flush(fd); // socket has room again
+                if (!(evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+                // edge-triggered: drain the socket, then handle every complete frame
+                FrameReader &in = it->second.in;
+                FrameReader::Status st = in.fill(fd);
+                string m;
+                while (in.next(m)) handle_request(fd, it->second.gen, m);
+                if (st != FrameReader::Open || in.corrupt()) {
+                    cout << "[DataServer] Game server disconnected (fd=" << fd << ")\n";
+                    if (it->second.subscribed) --subscribers;
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+                    close(fd);
+                    conns.erase(it);
+                }
             }
-        } catch (const exception &e) {
-            cerr << "[DataServer] Exception in action handler: " << e.what() << endl;
-            response = {{"response", "failed"}, {"reason", e.what()}};
         }
-
-        send_message(sockfd, response.dump());
+        commit_replies();
     }
 
-    close(sockfd);
-    saveUsers();
+    if (stop_requested) cout << "\n[DataServer] Caught SIGINT, compacting the log and exiting.\n";
+    close(listen_fd);
+    take_snapshot();
+    wal->close();
+    gamelogs->close();
     return 0;
 }
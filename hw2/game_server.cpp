@@ -10,63 +10,182 @@
 #include <errno.h>
 #include <string>
 #include <set>
+#include <deque>
 #include <unordered_map>
 #include "utility.h"
+#include "data_client.h"
+#include "session.h"
 #include "nlohmann/json.hpp"
 #include <cassert>
 #include <thread>
+#include <chrono>
 #include <signal.h>
-#include "tetris.h"
+#include "match.h"
 
 using json=nlohmann::json; using namespace std;
 
 const int GAME_SERVER_PORT=45632, DATA_SERVER_PORT=45631;
+const int GAME_PLAY_PORT=45633; // every match's gameplay connections, routed by the room id in the handshake
 const char *IP="127.0.0.1"; //140.113.17.11
 const int MAX_EVENTS=10;
+const auto HANDSHAKE_TIMEOUT=chrono::seconds(5); // a gameplay connection silent this long is closed
+// Lobby outbound queue limits (bytes); past the hard limit the client is disconnected
+// instead of stalling the loop (match connections have their own, see match.h).
+const size_t LOBBY_HIGH_WATER=256*1024, LOBBY_HARD_LIMIT=1024*1024;
 int datafd; 
+DataClient dataclient; // all data server traffic goes through here, replies are dispatched by main()'s epoll loop
+MatchScheduler *matches; // worker pool running every Tetris match
 unordered_map<int,int> logineds; // fd -> user id if not logined -> -1
 
-int make_socket_non_blocking(int s){int f=fcntl(s,F_GETFL,0);return fcntl(s,F_SETFL,f|O_NONBLOCK);}
+// A lobby connection handles its own requests one at a time (each may wait on data server
+// replies), while requests from different connections are in flight together.
+struct LobbyConn {
+    uint64_t gen = 0; // tells a reused fd apart from the connection a pending reply belongs to
+    bool busy = false;
+    deque<string> backlog;
+    FrameReader in;
+    FrameWriter out{LOBBY_HIGH_WATER, LOBBY_HARD_LIMIT};
+};
+unordered_map<int, LobbyConn> conns;
+uint64_t next_conn_gen = 1;
+struct PendingHandshake {
+    FrameReader in;
+    chrono::steady_clock::time_point deadline;
+};
+unordered_map<int, PendingHandshake> handshakes; // gameplay connections that haven't sent their handshake yet
+
+vector<int> lobby_unflushed; // lobby connections with frames queued during this wakeup
+
+// Queue a message on a lobby connection. A client that stops reading is shut down,
+// which the epoll loop then handles like any other disconnect; `droppable` messages
+// (pushed events) are skipped instead while it is behind. Nothing is written until
+// flush_lobby() at the end of the wakeup, so a reply and the events it caused leave together.
+void lobby_send(int fd, const FrameWriter::Frame &f, bool droppable = false) {
+    auto it = conns.find(fd);
+    if (it == conns.end()) return;
+    bool was_idle = it->second.out.idle();
+    FrameWriter::Result r = it->second.out.queue(f, droppable);
+    if (r == FrameWriter::Overflow || r == FrameWriter::Failed) {
+        cerr << "[GameServer] Lobby client fd=" << fd << " is not reading its replies, disconnecting\n";
+        shutdown(fd, SHUT_RDWR);
+    } else if (r == FrameWriter::Queued && was_idle) {
+        lobby_unflushed.push_back(fd);
+    }
+}
+
+void flush_lobby() {
+    for (int fd : lobby_unflushed) {
+        auto it = conns.find(fd);
+        if (it != conns.end() && !it->second.out.flush(fd)) shutdown(fd, SHUT_RDWR);
+    }
+    lobby_unflushed.clear();
+}
+void lobby_send(int fd, const json &j) { lobby_send(fd, FrameWriter::frame(j.dump())); }
+
+// The lobby connection a request came from, safe to use after that client has gone.
+struct Ctx {
+    int fd;
+    uint64_t gen;
+    bool alive() const { auto it = conns.find(fd); return it != conns.end() && it->second.gen == gen; }
+    void reply(const json &j) const { if (alive()) lobby_send(fd, j); }
+};
+
+void client_request(Ctx c, const string &msg);
+
+void submit_request(int fd, const string &msg) {
+    LobbyConn &lc = conns[fd];
+    if (lc.busy) {
+        lc.backlog.push_back(msg);
+        return;
+    }
+    lc.busy = true;
+    client_request(Ctx{fd, lc.gen}, msg);
+}
+
+// Every request path ends here exactly once; starts the connection's next queued request.
+void finish_request(const Ctx &c) {
+    if (!c.alive()) return;
+    LobbyConn &lc = conns[c.fd];
+    if (lc.backlog.empty()) {
+        lc.busy = false;
+        return;
+    }
+    string next = std::move(lc.backlog.front());
+    lc.backlog.pop_front();
+    client_request(c, next);
+}
+
+// Creates the user straight away: the data server refuses a name that is already taken,
+// which a query first could not guarantee with other requests in flight.
+void registering(Ctx c, const std::string &name, const std::string &password, function<void(int)> done) {
+    json new_user = {
+        {"id", -1}, // data server will overwrite
+        {"name", name},
+        {"password", password},
+        {"last_login", now_time_str()},
+        {"status", "idle"},
+        {"roomName", "-1"}
+    };
+    json create = {
+        {"action", "create"},
+        {"type", "user"},
+        {"data", new_user}
+    };
+    dataclient.request(create, [=](json resp) {
+        if (resp.value("response", "failed") == "success") {
+            json user = new_user;
+            user["id"] = resp["id"];
+            sessions.add(user, resp);
+            c.reply(json{{"response", "success"}});
+            cout << "[GameServer] Registered new user: " << name << endl;
+            return done(resp["id"]);
+        }
+        std::string reason = resp.value("reason", "");
+        if (reason == "data server unavailable") {
+            cerr << "[GameServer] Data server unavailable or returned empty reply.\n";
+        } else if (reason == "name taken") {
+            reason = "user already exists";
+        } else {
+            reason = "data server create failed";
+        }
+        c.reply(json{
+            {"response", "failed"},
+            {"reason", reason}
+        });
+        done(-1);
+    });
+}
+
+// Resumes `done` with the new user id, or -1 once the client has been told why it failed.
+void logining(Ctx c, const std::string &action, const std::string &name, const std::string &password, function<void(int)> done) {
+    if (action == "register") return registering(c, name, password, done);
 
-int logining(int fd, const std::string &action, const std::string &name, const std::string &password) {
     // --- Step 1. Ask data server for this user ---
     json query = {
         {"action", "query"},
         {"type", "user"},
         {"name", name}
     };
-    send_message(datafd, query.dump());
-    string reply = recv_message(datafd);
-
-    if (reply.empty() || reply == "Disconnected") {
-        cerr << "[GameServer] Data server unavailable or returned empty reply.\n";
-        send_message(fd, json{{"response", "failed"}, {"reason", "data server unavailable"}}.dump());
-        return -1;
-    }
-    // cerr<<"reply of logining "<<reply<<endl;
-    json resp;
-    try {
-        resp = json::parse(reply);
-    } catch (const std::exception &e) {
-        cerr << "[GameServer] JSON parse error from data server: " << e.what() << "\nRaw: " << reply << endl;
-        send_message(fd, json{{"response", "failed"}, {"reason", "invalid JSON from data server"}}.dump());
-        return -1;
-    }
-     
-    std::string status = resp.value("response", "failed");
-
-    // --- Step 2. Handle found user ---
-    if (status == "success") {
-        json user = resp["data"];
-
-        // ensure id exists
-        if (!user.contains("id") || user["id"].is_null()) {
-            cerr << "[GameServer] Warning: queried user missing 'id', inserting placeholder.\n";
-            static int fallback_id = 9999; // fallback only
-            user["id"] = fallback_id++;
-        }
+    dataclient.request(query, [=](json resp) {
+        // cerr<<"reply of logining "<<resp.dump()<<endl;
+        std::string status = resp.value("response", "failed");
+        if (resp.value("reason", "") == "data server unavailable") {
+            cerr << "[GameServer] Data server unavailable or returned empty reply.\n";
+            c.reply(json{{"response", "failed"}, {"reason", "data server unavailable"}});
+            return done(-1);
+        }
+
+        // --- Step 2. Handle found user ---
+        if (status == "success") {
+            json user = resp["data"];
+
+            // ensure id exists
+            if (!user.contains("id") || user["id"].is_null()) {
+                cerr << "[GameServer] Warning: queried user missing 'id', inserting placeholder.\n";
+                static int fallback_id = 9999; // fallback only
+                user["id"] = fallback_id++;
+            }
 
-        if (action == "login") {
             // existing user trying to login
             std::string stored_pw = user.value("password", "");
             std::string state = user.value("status", "offline");
@@ -80,862 +199,326 @@ int logining(int fd, const std::string &action, const std::string &name, const s
                     {"type", "user"},
                     {"data", user}
                 };
-                send_message(datafd, update.dump());
-                string update_reply = recv_message(datafd);  // Consume the update response
-
-                json ok = {{"response", "success"}};
-                send_message(fd, ok.dump());
-                cout << "[GameServer] User '" << name << "' logged in successfully (id=" << user["id"] << ")\n";
-                return user["id"];
+                dataclient.request(update, [=](json resp) {
+                    sessions.add(user, resp);
+                    c.reply(json{{"response", "success"}});
+                    cout << "[GameServer] User '" << name << "' logged in successfully (id=" << user["id"] << ")\n";
+                    done(user["id"]);
+                });
+                return;
             } else {
                 cerr << "[GameServer] Login failed for user '" << name << "': wrong password or already online.\n";
-                send_message(fd, json{
+                c.reply(json{
                     {"response", "failed"},
                     {"reason", "wrong password or already online"}
-                }.dump());
-                return -1;
+                });
+                return done(-1);
             }
-        } else {
-            // trying to register but user already exists
-            send_message(fd, json{
-                {"response", "failed"},
-                {"reason", "user already exists"}
-            }.dump());
-            return -1;
-        }
-    }
-
-    // --- Step 3. Handle missing user (create new) ---
-    if (status == "failed" && action == "register") {
-        json new_user = {
-            {"id", -1}, // data server will overwrite
-            {"name", name},
-            {"password", password},
-            {"last_login", now_time_str()},
-            {"status", "idle"},
-            {"roomName", "-1"}
-        };
-        json create = {
-            {"action", "create"},
-            {"type", "user"},
-            {"data", new_user}
-        };
-        send_message(datafd, create.dump());
-
-        std::string reply2 = recv_message(datafd);
-        json resp2;
-        try {
-            resp2 = json::parse(reply2);
-        } catch (...) {
-            cerr << "[GameServer] Invalid JSON from data server during create.\n";
-            send_message(fd, json{{"response", "failed"}, {"reason", "invalid JSON on create"}}.dump());
-            return -1;
         }
 
-        if (resp2.value("response", "failed") == "success") {
-            send_message(fd, json{{"response", "success"}}.dump());
-            cout << "[GameServer] Registered new user: " << name << endl;
-            return resp2["id"];
-        } else {
-            send_message(fd, json{
+        // --- Step 3. Login failed because user doesn’t exist ---
+        if (status == "failed") {
+            c.reply(json{
                 {"response", "failed"},
-                {"reason", "data server create failed"}
-            }.dump());
-            return -1;
+                {"reason", "user does not exist"}
+            });
+            cerr << "[GameServer] Login failed: no such user '" << name << "'\n";
+            return done(-1);
         }
-    }
 
-    // --- Step 4. Login failed because user doesn’t exist ---
-    if (status == "failed" && action == "login") {
-        send_message(fd, json{
+        // --- fallback ---
+        c.reply(json{
             {"response", "failed"},
-            {"reason", "user does not exist"}
-        }.dump());
-        cerr << "[GameServer] Login failed: no such user '" << name << "'\n";
-        return -1;
-    }
-
-    // --- fallback ---
-    send_message(fd, json{
-        {"response", "failed"},
-        {"reason", "unexpected error"}
-    }.dump());
-    cerr << "[GameServer] Unexpected condition in logining() for user '" << name << "'\n";
-    return -1;
+            {"reason", "unexpected error"}
+        });
+        cerr << "[GameServer] Unexpected condition in logining() for user '" << name << "'\n";
+        done(-1);
+    });
 }
 
-int logout_user(int fd) {
-    int uid = logineds[fd];
-    if (uid < 0) return -1;
-
-    // Step 1. Query the user
-    json query = {
-        {"action", "query"},
-        {"type", "user"},
-        {"id", uid}
-    };
-    send_message(datafd, query.dump());
-    string reply = recv_message(datafd);
-    // cerr<<reply<<endl;
-    if (reply.empty() || reply == "Disconnected") {
-        cerr << "[GameServer] Data server not responding during logout.\n";
-        return -1;
-    }
-
-    json resp;
-    try {
-        resp = json::parse(reply);
-    } catch (const std::exception &e) {
-        cerr << "[GameServer] JSON parse error from data server: " << e.what()
-             << "\nRaw: " << reply << endl;
-        return -1;
-    }
-
-    if (resp.value("response", "failed") != "success" || !resp.contains("data") || !resp["data"].is_object()) {
-        cerr<<resp.dump();
-        cerr << "[GameServer] logout_user(): user not found or invalid JSON\n";
-        return -1;
-    }
-
-    // Step 2. Update the user to offline
-    json user = resp["data"];
-    string uname = user.value("name", "(unknown)");
+void logout_user(int uid) {
+    if (uid < 0) return;
+    const json *me = sessions.find(uid);
+    string uname = me ? me->value("name", "(unknown)") : "(unknown)";
     cout << "[GameServer] Logging out user: " << uname << " (id=" << uid << ")\n";
 
-    user["status"] = "offline";
-
-    json update = {
-        {"action", "update"},
-        {"type", "user"},
-        {"data", user}
-    };
-    send_message(datafd, update.dump());
-
-    // Step 3. Verify update succeeded
-    string reply2 = recv_message(datafd);
-    if (reply2.empty() || reply2 == "Disconnected") {
-        cerr << "[GameServer] Data server disconnected during logout.\n";
-        return -1;
-    }
-
-    json resp2;
-    try {
-        resp2 = json::parse(reply2);
-    } catch (...) {
-        cerr << "[GameServer] Invalid JSON from data server during logout update: " << reply2 << endl;
-        return -1;
-    }
-
-    if (resp2.value("response", "failed") == "success") {
-        cout << "[GameServer] User " << uname << " successfully logged out.\n";
-        return 1;
-    } else {
-        cerr << "[GameServer] Data server failed to update user during logout: "
-             << resp2.dump() << endl;
-        return -1;
-    }
-}
-
-
-void handle_player_action(Tetris &game, const std::string &action) {
-    using A = Tetris::Action;
-    if (action == "Left") game.step(A::Left);
-    else if (action == "Right") game.step(A::Right);
-    else if (action == "SoftDrop") game.step(A::SoftDrop);
-    else if (action == "HardDrop") game.step(A::HardDrop);
-    else if (action == "RotateCW") game.step(A::RotateCW);
-    else if (action == "RotateCCW") game.step(A::RotateCCW);
-    else if (action == "Hold") game.step(A::Hold);
-}
-
-int savetodataserver(json &room, Tetris &game1, Tetris &game2){
-    string host_user = room.value("hostUser", "");
-    string oppo_user = room.value("oppoUser", "");
-
-    json tosave={
-        {"action","create"},
-        {"type","gamelog"},
-        {"data",{
-            {"room",room},
-            {"hostUser",host_user},
-            {"oppoUser",oppo_user},
-            {"host_result",game1.result_json()},
-            {"oppo_result",game2.result_json()}
-        }
-        }
-    };
-    send_message(datafd,tosave.dump());
-    recv_message(datafd);
-    return 0;
-}
-
-int start_game(json room, json pA, json pB){
-    string room_name = room.value("name", "");
-    string host_user = room.value("hostUser", "");
-    string oppo_user = room.value("oppoUser", "");
-    string start_time = now_time_str();
-    int room_id = room.value("id", 0);
-
-    cout << "[TetrisGameServer] Starting game for room '" << room_name << "' (id=" << room_id << ") - Players: " << host_user << " vs " << oppo_user << endl;
-
-    int port = room_id + 50000;
-    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_sock < 0) {
-        perror("[TetrisGameServer] socket() failed");
-        return 1;
-    }
-
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    if (inet_pton(AF_INET, IP, &addr.sin_addr) <= 0) {
-        cerr << "[TetrisGameServer] Invalid IP address: " << IP << endl;
-        close(listen_sock);
-        return 1;
-    }
-
-    int opt = 1;
-    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    if (bind(listen_sock, (sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("[TetrisGameServer] bind() failed");
-        close(listen_sock);
-        return 1;
-    }
-
-    if (listen(listen_sock, SOMAXCONN) < 0) {
-        perror("[TetrisGameServer] listen() failed");
-        close(listen_sock);
-        return 1;
-    }
-
-    cout << "[TetrisGameServer] Listening on port " << port << ", waiting for 2 players to connect..." << endl;
-
-    // Update room status to "playing"
-    room["status"] = "playing";
-    json update_room = {
-        {"action", "update"},
-        {"type", "room"},
-        {"data", room}
-    };
-    send_message(datafd, update_room.dump());
-    recv_message(datafd);  // Consume update response
-
-    // Accept connections and identify host/opponent
-    socklen_t sl = sizeof(addr);
-    int host_fd = -1, oppo_fd = -1;
-    std::vector<int> pending_spectators;
-
-    auto handle_handshake = [&](int fd) {
-        string hello = recv_message(fd);
-        if (hello.empty() || hello == "Disconnected") {
-            cerr << "[TetrisGameServer] Empty handshake from fd=" << fd << ", closing.\n";
-            close(fd);
-            return;
-        }
-        json payload;
-        try {
-            payload = json::parse(hello);
-        } catch (const std::exception &e) {
-            cerr << "[TetrisGameServer] Invalid handshake JSON from fd=" << fd << ": " << e.what() << endl;
-            close(fd);
-            return;
-        }
-
-        string action = payload.value("action", "");
-        string name = payload.value("name", "");
-        if (action == "ready") {
-            if (name == host_user && host_fd < 0) {
-                host_fd = fd;
-                cout << "[TetrisGameServer] Host player '" << name << "' ready (fd=" << fd << ")\n";
-            } else if (name == oppo_user && oppo_fd < 0) {
-                oppo_fd = fd;
-                cout << "[TetrisGameServer] Opponent player '" << name << "' ready (fd=" << fd << ")\n";
-            } else {
-                cerr << "[TetrisGameServer] Unexpected player handshake from '" << name
-                     << "' (fd=" << fd << "). Closing connection.\n";
-                send_message(fd, json{{"action","error"},{"reason","not part of this match"}}.dump());
-                close(fd);
-            }
-        } else if (action == "spectate") {
-            cout << "[TetrisGameServer] Spectator '" << name << "' pre-connected (fd=" << fd << ")\n";
-            pending_spectators.push_back(fd);
+    // Only the status changes, so no need to read the record first
+    dataclient.request(sessions.update(uid, {{"status", "offline"}}), [uname](json resp) {
+        if (resp.value("response", "failed") == "success") {
+            cout << "[GameServer] User " << uname << " successfully logged out.\n";
         } else {
-            cerr << "[TetrisGameServer] Unknown handshake action '" << action
-                 << "' from fd=" << fd << ", closing.\n";
-            send_message(fd, json{{"action","error"},{"reason","invalid handshake"}}.dump());
-            close(fd);
+            cerr << "[GameServer] Data server failed to update user during logout: "
+                 << resp.dump() << endl;
         }
-    };
-
-    while (host_fd < 0 || oppo_fd < 0) {
-        int new_fd = accept(listen_sock, (sockaddr*)&addr, &sl);
-        if (new_fd < 0) {
-            if (errno == EINTR) continue;
-            perror("[TetrisGameServer] accept() during handshake failed");
-            continue;
-        }
-        handle_handshake(new_fd);
-    }
-
-    int p1_fd = host_fd;
-    int p2_fd = oppo_fd;
-    cout << "[TetrisGameServer] Both players connected: host fd=" << p1_fd << ", opponent fd=" << p2_fd << endl;
-
-    // Make sockets non-blocking
-    make_socket_non_blocking(p1_fd);
-    make_socket_non_blocking(p2_fd);
-
-    // Make listen socket non-blocking to accept spectators during game
-    make_socket_non_blocking(listen_sock);
-
-    // Create epoll instance
-    int epoll_fd = epoll_create1(0);
-    if (epoll_fd < 0) {
-        perror("[TetrisGameServer] epoll_create1() failed");
-        close(p1_fd);
-        close(p2_fd);
-        close(listen_sock);
-        return 1;
-    }
-
-    // Add both player sockets to epoll
-    epoll_event ev{};
-    ev.events = EPOLLIN | EPOLLET;
-    ev.data.fd = p1_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, p1_fd, &ev) < 0) {
-        perror("[TetrisGameServer] epoll_ctl p1 failed");
-        close(epoll_fd);
-        close(p1_fd);
-        close(p2_fd);
-        close(listen_sock);
-        return 1;
-    }
-
-    ev.data.fd = p2_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, p2_fd, &ev) < 0) {
-        perror("[TetrisGameServer] epoll_ctl p2 failed");
-        close(epoll_fd);
-        close(p1_fd);
-        close(p2_fd);
-        close(listen_sock);
-        return 1;
-    }
-
-    // Add listen socket to epoll to accept spectators during game
-    ev.data.fd = listen_sock;
-    ev.events = EPOLLIN | EPOLLET;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sock, &ev) < 0) {
-        perror("[TetrisGameServer] epoll_ctl listen_sock failed");
-        close(epoll_fd);
-        close(p1_fd);
-        close(p2_fd);
-        close(listen_sock);
-        return 1;
-    }
-
-    // Track spectators, include any who connected before the match fully started
-    std::vector<int> spectator_fds;
-    for (int spec_fd : pending_spectators) {
-        make_socket_non_blocking(spec_fd);
-        spectator_fds.push_back(spec_fd);
-    }
-
-    cout << "[TetrisGameServer] Game started! with p1=" << host_user<<", and p2="<<oppo_user << endl;
-
-
-    // Main game loop with epoll
-    epoll_event events[MAX_EVENTS];
-    bool game_running = true;
-    bool player_disconnected = false;
-    int disconnected_fd = -1;
-
-    // Initialize games with seed (use room_id for deterministic seeding, or add custom seed)
-    uint32_t seed = room.value("seed", static_cast<uint32_t>(room_id));
-    int difficulty = room.value("difficulty", 10); // Default: 10 frames = easy, lower = harder
-    Tetris game1(seed, difficulty), game2(seed, difficulty);
-    
-    using namespace std::chrono;
-    auto next_tick = steady_clock::now();
-    const auto TICK_INTERVAL = 100ms; // 10 ticks per second
-    int frame = 0;
-
-    while (game_running) {
-        next_tick += TICK_INTERVAL;
-        frame++;
-
-        // --- 1️⃣ Handle player inputs and spectator connections ---
-        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 0);
-        for (int i = 0; i < n; i++) {
-            int client_fd = events[i].data.fd;
-            if (events[i].events & EPOLLIN) {
-                // Check if it's the listen socket (new spectator connecting)
-                if (client_fd == listen_sock) {
-                    while (true) {
-                        sockaddr_in spec_addr{};
-                        socklen_t spec_len = sizeof(spec_addr);
-                        int spec_fd = accept(listen_sock, (sockaddr*)&spec_addr, &spec_len);
-                        if (spec_fd < 0) {
-                            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                                perror("[TetrisGameServer] accept() spectator failed");
-                            }
-                            break;
-                        }
-
-                        // Add spectator to tracking
-                        make_socket_non_blocking(spec_fd);
-                        spectator_fds.push_back(spec_fd);
-                        cout << "[TetrisGameServer] Spectator connected (fd=" << spec_fd << "), total spectators: " << spectator_fds.size() << endl;
-                    }
-                } else {
-                    // Handle player input or spectator/player disconnections
-                    while (true) {
-                        string msg = recv_message(client_fd);
-                        if (msg.empty()) {
-                            break;
-                        }
-                        if (msg == "Disconnected") {
-                            // Check if it's a player or spectator
-                            if (client_fd == p1_fd || client_fd == p2_fd) {
-                                cout << "[TetrisGameServer] Player disconnected (fd=" << client_fd << "). Ending game." << endl;
-                                game_running = false;
-                                player_disconnected = true;
-                                disconnected_fd = client_fd;
-                            } else {
-                                // Remove spectator
-                                auto it = std::find(spectator_fds.begin(), spectator_fds.end(), client_fd);
-                                if (it != spectator_fds.end()) {
-                                    spectator_fds.erase(it);
-                                    cout << "[TetrisGameServer] Spectator disconnected (fd=" << client_fd << "), remaining: " << spectator_fds.size() << endl;
-                                }
-                            }
-                            break;
-                        }
-                        try {
-                            json game_msg = json::parse(msg);
-                            string action = game_msg.value("action", "");
-                            // Only process actions from actual players
-                            if (client_fd == p1_fd)
-                                handle_player_action(game1, action);
-                            else if (client_fd == p2_fd)
-                                handle_player_action(game2, action);
-                            // Spectators' actions are ignored
-                        } catch (const exception &e) {
-                            cerr << "[TetrisGameServer] JSON parse error: " << e.what() << endl;
-                        }
-                    }
-                    if (!game_running) break;
-                }
-            }
-        }
-
-        if (!game_running && player_disconnected) {
-            break;
-        }
-
-        // --- 2️⃣ Advance both games ---
-        // Let the Tetris engine handle auto-dropping internally based on framesSinceLastDrop
-        game1.step(Tetris::Action::None);
-        game2.step(Tetris::Action::None);
-
-        // --- 3️⃣ Send frame snapshot to players and spectators ---
-        // Send game states with usernames as keys
-        json state = {
-            {"f", frame},
-            {host_user, game1.to_json()},
-            {oppo_user, game2.to_json()}
-        };
-        string state_str = state.dump();
-
-        // Send to players
-        send_message(p1_fd, state_str);
-        send_message(p2_fd, state_str);
-
-        // Send to all spectators
-        for (auto it = spectator_fds.begin(); it != spectator_fds.end(); ) {
-            int spec_fd = *it;
-            try {
-                send_message(spec_fd, state_str);
-                ++it;
-            } catch (...) {
-                // Spectator disconnected, remove from list
-                cout << "[TetrisGameServer] Spectator (fd=" << spec_fd << ") send failed, removing" << endl;
-                close(spec_fd);
-                it = spectator_fds.erase(it);
-            }
-        }
-
-        // --- 4️⃣ End condition ---
-        if (game1.state().gameOver || game2.state().gameOver)
-            game_running = false;
-
-        // --- 5️⃣ Maintain steady tick rate ---
-        std::this_thread::sleep_until(next_tick);
-    }
+    });
+    sessions.remove(uid);
+}
 
-    // Cleanup
-    cout << "[TetrisGameServer] Cleaning up game for room '" << room_name << "'" << endl;
 
-    // Send final game over notification to both players
-    // Each player sees their own result as "my_result" and opponent as "opponent_result"
-    bool p1_won = player_disconnected ? (disconnected_fd == p2_fd) : game2.state().gameOver; // p1 wins if p2 tops out or disconnects
-    bool p2_won = player_disconnected ? (disconnected_fd == p1_fd) : game1.state().gameOver;
 
-    json game_over_p1 = {
-        {"action", "game_over"},
-        {"won", p1_won},
-        {"my_result", game1.result_json()},
-        {"opponent_result", game2.result_json()}
-    };
-
-    json game_over_p2 = {
-        {"action", "game_over"},
-        {"won", p2_won},
-        {"my_result", game2.result_json()},
-        {"opponent_result", game1.result_json()}
-    };
-
-    if (player_disconnected) {
-        game_over_p1["aborted"] = true;
-        game_over_p2["aborted"] = true;
+// A data server change event, pushed to the logged-in clients it concerns so they need
+// not poll curroom / curinvite: public room changes to everyone in the lobby, any change
+// of a room to the players in it, an invite to the invited user, and a user's status to
+// the other players in that user's room.
+void push_event(json ev) {
+    string kind = ev.value("event", "");
+    const json &data = ev["data"];
+    if (kind == "user") sessions.refresh(data, ev.value("seq", uint64_t{0})); // the change may come from another game server
+    FrameWriter::Frame frame; // framed once, on the first recipient
+    for (auto &[fd, uid] : logineds) {
+        const json *me = uid >= 0 ? sessions.find(uid) : nullptr;
+        if (!me) continue;
+        string status = me->value("status", ""), room = me->value("roomName", "-1");
+        bool wanted = false;
+        if (kind == "room")
+            wanted = (status == "idle" && data.value("visibility", "public") == "public") ||
+                     (status == "room" && room == data.value("name", ""));
+        else if (kind == "invite")
+            wanted = status == "idle" && uid == ev.value("user", -1);
+        else if (kind == "user")
+            wanted = status == "room" && room != "-1" && uid != data.value("id", -1) && room == data.value("roomName", "");
+        if (!wanted) continue;
+        if (!frame) frame = FrameWriter::frame(ev.dump());
+        lobby_send(fd, frame, true);
     }
-
-    send_message(p1_fd, game_over_p1.dump());
-    send_message(p2_fd, game_over_p2.dump());
-
-    // Give clients time to process the message before closing
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-    string endtime=now_time_str();
-
-    send_message(datafd,json{{"action","query"},{"type","room"},{"id",room.value("id", -1)}}.dump());
-    string search_reply = recv_message(datafd);
-    json room_query = json::parse(search_reply);
-    if(room_query.value("response","failed") == "success" && room_query.contains("data")){
-        room = room_query["data"];
-        if(room.contains("specList") && room["specList"].is_array()){
-            for(auto &spec_entry : room["specList"]){
-                int spec_id = spec_entry.is_number_integer() ? spec_entry.get<int>() : -1;
-                if(spec_id < 0) continue;
-                send_message(datafd,json{{"action","query"},{"type","user"},{"id",spec_id}}.dump());
-                string spec_reply = recv_message(datafd);
-                json spec_res = json::parse(spec_reply);
-                if(spec_res.value("response","failed") != "success" || !spec_res.contains("data")) continue;
-                json spec_user = spec_res["data"];
-                spec_user["status"] = "idle";
-                spec_user["roomName"] = "-1";
-                send_message(datafd,json{{"action","update"},{"type","user"},{"data",spec_user}}.dump());
-                recv_message(datafd);
-            }
-        }
-    } else {
-        cerr << "[TetrisGameServer] Failed to re-query room for cleanup: " << room_query.dump() << endl;
-    }
-    if (!player_disconnected && (game1.state().gameOver || game2.state().gameOver)) {
-        savetodataserver(room, game1, game2);
-    } else {
-        cout << "[TetrisGameServer] Game aborted before completion; skipping save to data server." << endl;
-    }
-
-
-
-    // Delete the room after game over
-    json cleanup_room = {
-        {"action", "delete"},
-        {"type", "room"},
-        {"data", room.value("name","")}
-    };
-    // cerr<<"fuck"<<room.dump()<<endl;
-    send_message(datafd, cleanup_room.dump());
-    recv_message(datafd);
-    // cerr<<"fuck"<<recv_message(datafd)<<endl;  // Consume delete response
-    //pA pB doesn't ensure who is host
-    pA["roomName"]="-1";
-    pA["status"]="idle";
-    json update_pA={
-        {"action", "update"},
-        {"type", "user"},
-        {"id", pA["id"]},
-        {"data", pA}
-    };
-    send_message(datafd, update_pA.dump());
-    recv_message(datafd);  // Consume update response
-    pB["roomName"]="-1";
-    pB["status"]="idle";
-    json update_pB={
-        {"action", "update"},
-        {"type", "user"},
-        {"id", pB["id"]},
-        {"data", pB}
-    };
-    send_message(datafd, update_pB.dump());
-    recv_message(datafd);  // Consume update response
-
-    
-
-    close(p1_fd);
-    close(p2_fd);
-    for(auto &t:spectator_fds)close(t);
-    close(listen_sock);
-    close(epoll_fd);
-
-    return 0;
 }
 
-int client_request(int fd,const string&msg){
+void lobby_action(Ctx c, const string &act, const json &j, json me);
+
+void client_request(Ctx c, const string &msg){
     json j;
     try{j=json::parse(msg);}
     catch(...){
-        send_message(fd,json{{"response","failed"},{"reason","invalid JSON"}}.dump());
-        return 0;
-    }
-    if(logineds[fd]==-1){
-        int uid=logining(fd,j["action"],j["name"],j["password"]);
-        //cerr<<"does go to logining\n";
-        if(uid>=0)logineds[fd]=uid;
-        return uid;
+        c.reply(json{{"response","failed"},{"reason","invalid JSON"}});
+        return finish_request(c);
+    }
+    if(logineds[c.fd]==-1){
+        logining(c,j["action"],j["name"],j["password"],[c](int uid){
+            //cerr<<"does go to logining\n";
+            if(uid>=0){
+                if(c.alive())logineds[c.fd]=uid;
+                else logout_user(uid); // client left while the login was in flight
+            }
+            finish_request(c);
+        });
+        return;
     }
-    int uid=logineds[fd];
+    int uid=logineds[c.fd];
     string act=j["action"];
-    // query user itself
-    send_message(datafd,json{{"action","query"},{"type","user"},{"id",uid}}.dump());
-    string self_reply = recv_message(datafd);
-    json self_resp = json::parse(self_reply);
-    if(self_resp.value("response", "failed") != "success" || !self_resp.contains("data")) {
-        send_message(fd,json{{"response","failed"},{"reason","failed to query user"}}.dump());
-        return 0;
-    }
-    json me = self_resp["data"];
-    me["id"]=uid;
+    // the caller's own record comes from the session cache, kept current by every write to it
+    if(const json *me=sessions.find(uid)) return lobby_action(c,act,j,*me);
+    dataclient.request(json{{"action","query"},{"type","user"},{"id",uid}},[c,j,act,uid](json self_resp){
+        if(self_resp.value("response", "failed") != "success" || !self_resp.contains("data")) {
+            c.reply(json{{"response","failed"},{"reason","failed to query user"}});
+            return finish_request(c);
+        }
+        json me = self_resp["data"];
+        me["id"]=uid;
+        sessions.add(me, self_resp);
+        lobby_action(c,act,j,me);
+    });
+}
 
+void lobby_action(Ctx c, const string &act, const json &j, json me){
+    int uid=me["id"];
     if(act=="create"){ // room
         string room=j["roomname"];
         string vis=j.value("visibility","public");
         int difficulty=j.value("difficulty",10);
-        cerr << "[GameServer] User '" << me["name"] << "' attempting to create room '" << room << "' (visibility=" << vis << ", difficulty=" << difficulty << ")" << endl;
-        json check={{"action","search"},{"type","room"}};
-        send_message(datafd,check.dump());
-        json r=json::parse(recv_message(datafd));
-        if(r.contains("data") && r["data"].is_array()) {
-            for(auto &x:r["data"])
-                if(x["name"]==room){
+        int tick_rate=j.value("tickRate",10);
+        cerr << "[GameServer] User '" << me["name"] << "' attempting to create room '" << room << "' (visibility=" << vis << ", difficulty=" << difficulty << ", tickRate=" << tick_rate << ")" << endl;
+        // the data server refuses a taken name, so two creates of one room cannot both succeed
+        json newroom={{"name",room},{"hostUser",me["name"]},{"oppoUser",""},{"visibility",vis},{"inviteList",json::array()},{"status","idle"},{"difficulty",difficulty},{"tickRate",tick_rate}};
+        dataclient.request(json{{"action","create"},{"type","room"},{"data",newroom}},[=](json create_resp){
+            if(create_resp.value("response", "failed") != "success") {
+                if(create_resp.value("reason","")=="name taken"){
                     cerr << "[GameServer] Room creation failed: room '" << room << "' already exists" << endl;
-                    send_message(fd,json{{"response","failed"},{"reason","duplicate room"}}.dump());
-                    return 0;
+                    c.reply(json{{"response","failed"},{"reason","duplicate room"}});
+                    return finish_request(c);
                 }
-        }
-        json newroom={{"name",room},{"hostUser",me["name"]},{"oppoUser",""},{"visibility",vis},{"inviteList",json::array()},{"status","idle"},{"difficulty",difficulty}};
-        send_message(datafd,json{{"action","create"},{"type","room"},{"data",newroom}}.dump());
-        string create_reply = recv_message(datafd);
-        json create_resp = json::parse(create_reply);
-        if(create_resp.value("response", "failed") != "success") {
-            cerr << "[GameServer] Room creation failed: data server error" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","failed to create room"}}.dump());
-            return 0;
-        }
-        send_message(datafd,json{{"action","query"},{"type","room"},{"name",room}}.dump());
-        string query_reply = recv_message(datafd);
-        json qr=json::parse(query_reply);
-        if(qr.value("response", "failed") != "success" || !qr.contains("data")) {
-            send_message(fd,json{{"response","failed"},{"reason","room query failed"}}.dump());
-            return 0;
-        }
-        me["roomName"]=room;
-        me["status"]="room";
-        send_message(datafd,json{{"action","update"},{"type","user"},{"data",me}}.dump());
-        recv_message(datafd);  // Consume update response
-        cout << "[GameServer] User '" << me["name"] << "' successfully created and joined room '" << room << "'" << endl;
-        send_message(fd,json{{"response","success"}}.dump());return 1;
+                cerr << "[GameServer] Room creation failed: data server error" << endl;
+                c.reply(json{{"response","failed"},{"reason","failed to create room"}});
+                return finish_request(c);
+            }
+            dataclient.request(sessions.update(uid,{{"roomName",room},{"status","room"}}),[=](json resp){
+                sessions.settled(uid,resp);
+                cout << "[GameServer] User '" << me["name"] << "' successfully created and joined room '" << room << "'" << endl;
+                c.reply(json{{"response","success"}});
+                finish_request(c);
+            });
+        });
+        return;
     }
     else if(act=="join"){
         string room=j["roomname"];
         cerr << "[GameServer] User '" << me["name"] << "' attempting to join room '" << room << "'" << endl;
-        json s={{"action","search"},{"type","room"}};send_message(datafd,s.dump());
-        json sres=json::parse(recv_message(datafd));json target;
-        if(sres.contains("data") && sres["data"].is_array()) {
-            for(auto&r:sres["data"])if(r["name"]==room)target=r;
-        }
-        if(target.empty()){
-            cerr << "[GameServer] Join room failed: room '" << room << "' not found" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","no such room"}}.dump());
-            return 0;
-        }
-        if(target["status"]=="playing"){
-            cerr << "[GameServer] Join room failed: room '" << room << "' is busy" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","busy"}}.dump());
-            return 0;
-        }
+        json q={{"action","query"},{"type","room"},{"name",room}};
+        dataclient.request(q,[=](json qres){
+            json target;
+            if(qres.value("response","failed")=="success" && qres.contains("data"))target=qres["data"];
+            if(target.empty()){
+                cerr << "[GameServer] Join room failed: room '" << room << "' not found" << endl;
+                c.reply(json{{"response","failed"},{"reason","no such room"}});
+                return finish_request(c);
+            }
+            if(target["status"]=="playing"){
+                cerr << "[GameServer] Join room failed: room '" << room << "' is busy" << endl;
+                c.reply(json{{"response","failed"},{"reason","busy"}});
+                return finish_request(c);
+            }
 
-        // Update room to set oppoUser
-        target["oppoUser"] = me["name"];
-        send_message(datafd,json{{"action","update"},{"type","room"},{"data",target}}.dump());
-        recv_message(datafd);  // Consume update response
-
-        // Update user status
-        me["roomName"]=room;
-        me["status"]="room";
-        send_message(datafd,json{{"action","update"},{"type","user"},{"data",me}}.dump());
-        recv_message(datafd);  // Consume update response
-        cout << "[GameServer] User '" << me["name"] << "' successfully joined room '" << room << "'" << endl;
-        send_message(fd,json{{"response","success"}}.dump());return 1;
+            // Update room to set oppoUser, and the user's status, both in flight at once
+            target["oppoUser"] = me["name"];
+            dataclient.request_all({
+                json{{"action","update"},{"type","room"},{"data",target}},
+                sessions.update(uid,{{"roomName",room},{"status","room"}})
+            },[=](vector<json> resps){
+                sessions.settled(uid,resps[1]);
+                cout << "[GameServer] User '" << me["name"] << "' successfully joined room '" << room << "'" << endl;
+                c.reply(json{{"response","success"}});
+                finish_request(c);
+            });
+        });
+        return;
     }
     else if(act=="curroom"){
         string current_room = me.value("roomName", "-1");
         cerr << "[GameServer] User '" << me["name"] << "' querying current room" << endl;
         if(current_room == "-1"){
-            // User not in a room - show all public rooms
-            cerr << "[GameServer] User not in room, listing all public rooms" << endl;
-            send_message(datafd,json{{"action","search"},{"type","room"}}.dump());
-            string search_reply = recv_message(datafd);
-            json search_res = json::parse(search_reply);
-            json filtered_search_res=json::array();
-            
-            if(search_res.value("response", "failed") == "success" && search_res.contains("data")) {
-                for(auto &r:search_res["data"]){
-                    if(r.value("visibility","public")=="public")filtered_search_res.push_back(r);
-                }
-                if(filtered_search_res.size()){
-                    cout << "[GameServer] Retrieved " << filtered_search_res.size() << " public rooms for user '" << me["name"] << "'" << endl;
-                    send_message(fd,json{{"response","success"},{"data",filtered_search_res}}.dump());
+            // User not in a room - show a page of public rooms, the client may pass "cursor" for the next one
+            cerr << "[GameServer] User not in room, listing public rooms" << endl;
+            json search={{"action","search"},{"type","room"},{"filter",{{"visibility","public"}}},{"cursor",j.value("cursor",0)}};
+            dataclient.request(search,[=](json search_res){
+                if(search_res.value("response", "failed") == "success" && search_res.contains("data")) {
+                    json &page=search_res["data"];
+                    if(page.size()){
+                        cout << "[GameServer] Retrieved " << page.size() << " public rooms for user '" << me["name"] << "'" << endl;
+                        json reply={{"response","success"},{"data",page}};
+                        if(search_res.contains("next"))reply["next"]=search_res["next"];
+                        c.reply(reply);
+                    }
+                    else {
+                        cerr << "[GameServer] Room search failed or no public rooms available" << endl;
+                        c.reply(json{{"response","failed"},{"reason",search_res.value("reason", "no available room")}});
+                    }
                 }
-                else {
+                else{
                     cerr << "[GameServer] Room search failed or no public rooms available" << endl;
-                    send_message(fd,json{{"response","failed"},{"reason",search_res.value("reason", "no available room")}}.dump());
+                    c.reply(json{{"response","failed"},{"reason",search_res.value("reason", "no available room")}});
                 }
-            }
-            else{
-                cerr << "[GameServer] Room search failed or no public rooms available" << endl;
-                send_message(fd,json{{"response","failed"},{"reason",search_res.value("reason", "no available room")}}.dump());
-            }
-            return 1;
+                finish_request(c);
+            });
+            return;
         }
         else{
             cerr<<"[GameServer] User in the game tried to do curroom, this is an issue\n";
-            return -1;
+            return finish_request(c);
         }
-        return 1;
     }
     else if (act == "curinvite") {
         cerr << "[GameServer] User '" << me["name"] << "' querying current invites" << endl;
-        // 1. Ask Data Server for all rooms
+        // 1. Ask Data Server for the rooms whose inviteList holds this user's id (served from its invite index)
         json req = {
-            {"action", "search"},
-            {"type", "room"}
+            {"action", "query"},
+            {"type", "invites"},
+            {"id", uid},
+            {"cursor", j.value("cursor", 0)}
         };
-        send_message(datafd, req.dump());
 
         // 2. Receive reply
-        string reply = recv_message(datafd);
-        json res;
-        try {
-            res = json::parse(reply);
-        } catch (const exception &e) {
-            cerr << "[GameServer] Failed to parse data server response in curinvite: " << e.what() << endl;
-            send_message(fd, json{{"response", "failed"}, {"reason", "invalid JSON from data server"}}.dump());
-            return 0;
-        }
-
-        // 3. Collect rooms that contain this user's id in inviteList
-        json arr = json::array();
-
-        if (res.contains("data") && res["data"].is_array()) {
-            for (auto &r : res["data"]) {
-                if (!r.contains("inviteList") || !r["inviteList"].is_array())
-                    continue;
-
-                for (auto &x : r["inviteList"]) {
-                    if (x.is_number_integer() && x.get<int>() == uid) {
-                        arr.push_back(r);
-                        break;  // no need to check more invites for this room
-                    }
-                }
+        dataclient.request(req, [=](json res) {
+            json arr = json::array();
+            if (res.contains("data") && res["data"].is_array()) arr = res["data"];
+
+            // 3. Send back the page
+            json reply_to_client;
+            if (arr.empty()) {
+                cerr << "[GameServer] User '" << me["name"] << "' has no pending invites" << endl;
+                reply_to_client = {
+                    {"response", "failed"},
+                    {"reason", "no invites"}
+                };
+            } else {
+                cout << "[GameServer] User '" << me["name"] << "' has " << arr.size() << " pending invite(s)" << endl;
+                reply_to_client = {
+                    {"response", "success"},
+                    {"data", arr}
+                };
+                if (res.contains("next")) reply_to_client["next"] = res["next"];
             }
-        } else {
-            cerr << "[GameServer] Invalid room data from data server: " << res.dump() << endl;
-        }
 
-        // 4. Send back filtered result
-        json reply_to_client;
-        if (arr.empty()) {
-            cerr << "[GameServer] User '" << me["name"] << "' has no pending invites" << endl;
-            reply_to_client = {
-                {"response", "failed"},
-                {"reason", "no invites"}
-            };
-        } else {
-            cout << "[GameServer] User '" << me["name"] << "' has " << arr.size() << " pending invite(s)" << endl;
-            reply_to_client = {
-                {"response", "success"},
-                {"data", arr}
-            };
-        }
-
-        send_message(fd, reply_to_client.dump());
-        return 1;
+            c.reply(reply_to_client);
+            finish_request(c);
+        });
+        return;
     }
     else if(act=="invite"){
         // Get the user to invite (client sends "name" field)
         string uname = j.value("name", j.value("user", ""));
         if(uname.empty()) {
             cerr << "[GameServer] Invite failed: no user specified" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","no user specified"}}.dump());
-            return 0;
+            c.reply(json{{"response","failed"},{"reason","no user specified"}});
+            return finish_request(c);
         }
 
         // Get current room from user's status
         string room = me.value("roomName", "-1");
         if(room == "-1") {
             cerr << "[GameServer] Invite failed: user '" << me["name"] << "' is not in a room" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","not in a room"}}.dump());
-            return 0;
+            c.reply(json{{"response","failed"},{"reason","not in a room"}});
+            return finish_request(c);
         }
 
         cerr << "[GameServer] User '" << me["name"] << "' attempting to invite '" << uname << "' to room '" << room << "'" << endl;
 
-        // Query the user to invite
-        send_message(datafd,json{{"action","query"},{"type","user"},{"name",uname}}.dump());
-        json u=json::parse(recv_message(datafd));
-        if(u.value("response","failed") != "success" || !u.contains("data")){
-            cerr << "[GameServer] Invite failed: user '" << uname << "' not found" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","no such user"}}.dump());
-            return 0;
-        }
-        int tid=u["data"]["id"];
-
-        // Query the room
-        send_message(datafd,json{{"action","query"},{"type","room"},{"name",room}}.dump());
-        string room_reply = recv_message(datafd);
-        json rr=json::parse(room_reply);
-        if(rr.value("response","failed") != "success" || !rr.contains("data")) {
-            cerr << "[GameServer] Invite failed: room '" << room << "' not found" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","room not found"}}.dump());
-            return 0;
-        }
+        // Query the user to invite and the room together
+        dataclient.request_all({
+            json{{"action","query"},{"type","user"},{"name",uname}},
+            json{{"action","query"},{"type","room"},{"name",room}}
+        },[=](vector<json> replies){
+            json &u=replies[0], &rr=replies[1];
+            if(u.value("response","failed") != "success" || !u.contains("data")){
+                cerr << "[GameServer] Invite failed: user '" << uname << "' not found" << endl;
+                c.reply(json{{"response","failed"},{"reason","no such user"}});
+                return finish_request(c);
+            }
+            int tid=u["data"]["id"];
 
-        json roomj=rr["data"];
-        if(roomj["hostUser"]!=me["name"]){
-            cerr << "[GameServer] Invite failed: user '" << me["name"] << "' is not host of room '" << room << "'" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","not host"}}.dump());
-            return 0;
-        }
-        auto&inv=roomj["inviteList"];
-        bool ex=false;
-        for(auto&x:inv)if(x==tid)ex=true;
-        if(!ex)inv.push_back(tid);
-        send_message(datafd,json{{"action","update"},{"type","room"},{"data",roomj}}.dump());
-        recv_message(datafd);
-        cout << "[GameServer] User '" << me["name"] << "' successfully invited '" << uname << "' (id=" << tid << ") to room '" << room << "'" << endl;
-        send_message(fd,json{{"response","success"}}.dump());
-        return 1;
+            if(rr.value("response","failed") != "success" || !rr.contains("data")) {
+                cerr << "[GameServer] Invite failed: room '" << room << "' not found" << endl;
+                c.reply(json{{"response","failed"},{"reason","room not found"}});
+                return finish_request(c);
+            }
+
+            json roomj=rr["data"];
+            if(roomj["hostUser"]!=me["name"]){
+                cerr << "[GameServer] Invite failed: user '" << me["name"] << "' is not host of room '" << room << "'" << endl;
+                c.reply(json{{"response","failed"},{"reason","not host"}});
+                return finish_request(c);
+            }
+            auto&inv=roomj["inviteList"];
+            bool ex=false;
+            for(auto&x:inv)if(x==tid)ex=true;
+            if(!ex)inv.push_back(tid);
+            dataclient.request(json{{"action","update"},{"type","room"},{"data",roomj}},[=](json){
+                cout << "[GameServer] User '" << me["name"] << "' successfully invited '" << uname << "' (id=" << tid << ") to room '" << room << "'" << endl;
+                c.reply(json{{"response","success"}});
+                finish_request(c);
+            });
+        });
+        return;
     }
     else if(act=="start"){
         //check if there are 2 player in the room
-        send_message(datafd,json{{"action","query"},{"type","room"},{"name",me["roomName"]}}.dump());
-        string query_reply = recv_message(datafd);
-        json query_res = json::parse(query_reply);
-        if(query_res.value("response", "failed") == "success") {
+        dataclient.request(json{{"action","query"},{"type","room"},{"name",me["roomName"]}},[=](json query_res){
+            if(query_res.value("response", "failed") != "success") {
+                cerr << "[GameServer] Query of room failed, fix it" << endl;
+                c.reply(json{{"response","failed"},{"reason",query_res.value("reason", "no room")}});
+                return finish_request(c);
+            }
             if(!query_res.contains("data")){
-                send_message(fd,json{{"response","failed"},{"reason","data_server side:"+query_res.value("reason", "no data of room")}}.dump());
-                return -1;
+                c.reply(json{{"response","failed"},{"reason","data_server side:"+query_res.value("reason", "no data of room")}});
+                return finish_request(c);
             }
             json room=query_res["data"];
             string host_user = room.value("hostUser", "");
@@ -944,99 +527,137 @@ int client_request(int fd,const string&msg){
             // Validate that both host and opponent exist
             if(host_user.empty() || oppo_user.empty()){
                 string missing = host_user.empty() ? "host" : "opponent";
-                send_message(fd,json{{"response","failed"},{"reason","need both host and opponent to start (missing " + missing + ")"}}.dump());
-                return 0; // Return 0 to keep player in room state
+                c.reply(json{{"response","failed"},{"reason","need both host and opponent to start (missing " + missing + ")"}});
+                return finish_request(c); // keep player in room state
             }
 
-            // Both players exist, start the game
-            send_message(fd,json{{"response","success"}}.dump());
+            if(room.value("status", "")=="playing"){
+                c.reply(json{{"response","failed"},{"reason","game already started"}});
+                return finish_request(c);
+            }
 
             // Find and notify the opponent user
             string oppo_name = (room["hostUser"] == me["name"]) ? room.value("oppoUser", "") : room.value("hostUser", "");
-            json oppo_res;
-            if (!oppo_name.empty()) {
-                // Query opponent user to get their id
-                send_message(datafd, json{{"action","query"},{"type","user"},{"name",oppo_name}}.dump());
-                string oppo_reply = recv_message(datafd);
-                oppo_res = json::parse(oppo_reply);
+            dataclient.request(json{{"action","query"},{"type","user"},{"name",oppo_name}},[=](json oppo_res){
+                // the status check above cannot see a start that is still in flight; launch can
+                if (!matches->launch(room, me, oppo_res.value("data", json()))) {
+                    c.reply(json{{"response","failed"},{"reason","game already started"}});
+                    return finish_request(c);
+                }
+                // Both players exist, start the game
+                c.reply(json{{"response","success"}});
                 if (oppo_res.value("response", "failed") == "success" && oppo_res.contains("data")) {
                     int oppo_id = oppo_res["data"].value("id", -1);
                     // Find opponent's fd in logineds map
                     for (auto& [oppo_fd, oppo_uid] : logineds) {
                         if (oppo_uid == oppo_id) {
-                            send_message(oppo_fd, json{{"action","start"},{"data",room}}.dump());
+                            lobby_send(oppo_fd, json{{"action","start"},{"data",room}});
                             break;
                         }
                     }
                 }
-            }
-            // Send start message to the current user as well
-            send_message(fd, json{{"action","start"},{"data",room}}.dump());
-            thread t(start_game, room, me, oppo_res["data"]);
-            t.detach();
-            return 1;
-        } 
-        else {
-            cerr << "[GameServer] Query of room failed, fix it" << endl;
-            send_message(fd,json{{"response","failed"},{"reason",query_res.value("reason", "no room")}}.dump());
-        }
+                // Send start message to the current user as well
+                c.reply(json{{"action","start"},{"data",room}});
+                finish_request(c);
+            });
+        });
+        return;
     }
     else if(act=="spectate"){
         string room=j["roomname"];
         cerr << "[GameServer] User '" << me["name"] << "' attempting to spectate room '" << room << "'" << endl;
 
         // Query the specific room
-        send_message(datafd,json{{"action","query"},{"type","room"},{"name",room}}.dump());
-        string room_reply = recv_message(datafd);
-        json room_res = json::parse(room_reply);
-
-        if(room_res.value("response","failed") != "success" || !room_res.contains("data")) {
-            cerr << "[GameServer] Spectate failed: room '" << room << "' not found" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","no such room"}}.dump());
-            return 0;
-        }
+        dataclient.request(json{{"action","query"},{"type","room"},{"name",room}},[=](json room_res){
+            if(room_res.value("response","failed") != "success" || !room_res.contains("data")) {
+                cerr << "[GameServer] Spectate failed: room '" << room << "' not found" << endl;
+                c.reply(json{{"response","failed"},{"reason","no such room"}});
+                return finish_request(c);
+            }
 
-        json target = room_res["data"];
+            json target = room_res["data"];
 
-        // Check if room is actually playing (spectators can only watch active games)
-        if(target["status"] != "playing"){
-            cerr << "[GameServer] Spectate failed: room '" << room << "' is not playing" << endl;
-            send_message(fd,json{{"response","failed"},{"reason","room not playing"}}.dump());
-            return 0;
-        }
+            // Check if room is actually playing (spectators can only watch active games)
+            if(target["status"] != "playing"){
+                cerr << "[GameServer] Spectate failed: room '" << room << "' is not playing" << endl;
+                c.reply(json{{"response","failed"},{"reason","room not playing"}});
+                return finish_request(c);
+            }
 
-        // Update room status to add spec id to the room
-        if(!target.contains("specList") || !target["specList"].is_array()){
-            target["specList"] = json::array();
-        }
-        bool already_in = false;
-        for(auto &sid : target["specList"]){
-            if(sid == me["id"]){
-                already_in = true;
-                break;
+            // Update room status to add spec id to the room
+            if(!target.contains("specList") || !target["specList"].is_array()){
+                target["specList"] = json::array();
+            }
+            bool already_in = false;
+            for(auto &sid : target["specList"]){
+                if(sid == me["id"]){
+                    already_in = true;
+                    break;
+                }
+            }
+            if(!already_in){
+                target["specList"].push_back(me["id"]);
             }
-        }
-        if(!already_in){
-            target["specList"].push_back(me["id"]);
-        }
-        send_message(datafd,json{{"action","update"},{"type","room"},{"data",target}}.dump());
-        recv_message(datafd);  // Consume update response
 
-        // Update user status to spectating
-        me["roomName"] = room;
-        me["status"] = "spectating";
-        send_message(datafd,json{{"action","update"},{"type","user"},{"data",me}}.dump());
-        recv_message(datafd);  // Consume update response
+            // Update user status to spectating, together with the room
+            dataclient.request_all({
+                json{{"action","update"},{"type","room"},{"data",target}},
+                sessions.update(uid,{{"roomName",room},{"status","spectating"}})
+            },[=](vector<json> resps){
+                sessions.settled(uid,resps[1]);
+                cout << "[GameServer] User '" << me["name"] << "' successfully joined room '" << room << "' as spectator" << endl;
+
+                // Send success and room info to spectator
+                c.reply(json{{"response","success"}});
+                c.reply(json{{"action","spectate"},{"data",target}});
+                finish_request(c);
+            });
+        });
+        return;
+    }
+    c.reply(json{{"response","failed"},{"reason","unknown action"}});
+    finish_request(c);
+}
 
-        cout << "[GameServer] User '" << me["name"] << "' successfully joined room '" << room << "' as spectator" << endl;
+// Read the first frame of a gameplay connection and pass the fd to the worker running its match.
+// Handshake: {"action":"ready"|"spectate","name":...,"room":<room id>}
+void route_gameplay(int epfd, int fd){
+    FrameReader &in=handshakes[fd].in;
+    FrameReader::Status st=in.fill(fd);
+    string hello;
+    if(!in.next(hello)){
+        if(st!=FrameReader::Open||in.corrupt()){
+            epoll_ctl(epfd,EPOLL_CTL_DEL,fd,nullptr);
+            handshakes.erase(fd);
+            close(fd);
+        }
+        return; // handshake not complete yet
+    }
+    epoll_ctl(epfd,EPOLL_CTL_DEL,fd,nullptr);
+    FrameReader rest=std::move(in);
+    handshakes.erase(fd);
+
+    int room_id=-1;
+    try{
+        json h=json::parse(hello);
+        if(h.contains("room")&&h["room"].is_number_integer())room_id=h["room"];
+    }catch(...){}
+    if(room_id>=0&&matches->route(room_id,fd,hello,std::move(rest)))return;
+    cerr<<"[GameServer] Gameplay handshake for unknown room from fd="<<fd<<": "<<hello<<endl;
+    FrameWriter().send(fd,json{{"action","error"},{"reason","no such match"}}.dump());
+    close(fd);
+}
 
-        // Send success and room info to spectator
-        send_message(fd,json{{"response","success"}}.dump());
-        send_message(fd,json{{"action","spectate"},{"data",target}}.dump());
-        return 1;
+// Close gameplay connections whose handshake is overdue, so a silent peer cannot hold an fd.
+void expire_handshakes(int epfd){
+    auto now=chrono::steady_clock::now();
+    for(auto it=handshakes.begin();it!=handshakes.end();){
+        if(it->second.deadline>now){++it;continue;}
+        cerr<<"[GameServer] Gameplay handshake timed out on fd="<<it->first<<endl;
+        epoll_ctl(epfd,EPOLL_CTL_DEL,it->first,nullptr);
+        close(it->first);
+        it=handshakes.erase(it);
     }
-    send_message(fd,json{{"response","failed"},{"reason","unknown action"}}.dump());
-    return 0;
 }
 
 int main() {
@@ -1049,6 +670,7 @@ int main() {
     }
 
     sockaddr_in addr{};
+
     addr.sin_family = AF_INET;
     addr.sin_port = htons(GAME_SERVER_PORT);
     if (inet_pton(AF_INET, IP, &addr.sin_addr) <= 0) {
@@ -1072,6 +694,24 @@ int main() {
         return 1;
     }
 
+    // === Create the shared gameplay socket ===
+    int play_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (play_sock < 0) {
+        perror("[GameServer] socket() for gameplay failed");
+        close(listen_sock);
+        return 1;
+    }
+    sockaddr_in paddr = addr;
+    paddr.sin_port = htons(GAME_PLAY_PORT);
+    setsockopt(play_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(play_sock, (sockaddr *)&paddr, sizeof(paddr)) < 0 || listen(play_sock, SOMAXCONN) < 0) {
+        perror("[GameServer] bind()/listen() for gameplay failed");
+        close(listen_sock);
+        close(play_sock);
+        return 1;
+    }
+    make_socket_non_blocking(play_sock);
+
     // === Connect to Data Server ===
     datafd = socket(AF_INET, SOCK_STREAM, 0);
     if (datafd < 0) {
@@ -1098,6 +738,14 @@ int main() {
     }
 
     cout << "[GameServer] Connected to Data Server at " << IP << ":" << DATA_SERVER_PORT << endl;
+    set_no_delay(datafd); // many small pipelined requests, none should wait for an ACK
+    dataclient.attach(datafd);
+    dataclient.on_event(push_event);
+    dataclient.request(json{{"action","subscribe"}},[](json resp){
+        if(resp.value("response","failed")!="success")
+            cerr << "[GameServer] Could not subscribe to data server events, clients will have to poll: " << resp.dump() << endl;
+    });
+    matches = new MatchScheduler(dataclient);
 
     // === Create epoll ===
     int epfd = epoll_create1(0);
@@ -1126,35 +774,93 @@ int main() {
         return 1;
     }
 
+    // Data server replies are read here and resume whichever handler is waiting on them
+    epoll_event dev{.events = EPOLLIN, .data = {.fd = datafd}};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, datafd, &dev) < 0) {
+        perror("[GameServer] epoll_ctl(ADD datafd) failed");
+        close(listen_sock);
+        close(datafd);
+        close(epfd);
+        return 1;
+    }
+
+    // Failed requests from match workers come back to this thread through the wake fd
+    epoll_event wev{.events = EPOLLIN, .data = {.fd = dataclient.wake_fd()}};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, dataclient.wake_fd(), &wev) < 0) {
+        perror("[GameServer] epoll_ctl(ADD data client wake fd) failed");
+        close(listen_sock);
+        close(datafd);
+        close(epfd);
+        return 1;
+    }
+
+    epoll_event pev{.events = EPOLLIN, .data = {.fd = play_sock}};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, play_sock, &pev) < 0) {
+        perror("[GameServer] epoll_ctl(ADD play_sock) failed");
+        close(listen_sock);
+        close(play_sock);
+        close(datafd);
+        close(epfd);
+        return 1;
+    }
+
     cout << "[GameServer] Listening on " << IP << ":" << GAME_SERVER_PORT << " and ready!\n";
+    cout << "[GameServer] Gameplay connections on " << IP << ":" << GAME_PLAY_PORT << endl;
 
     epoll_event evs[MAX_EVENTS];
     while(true){
-        int n=epoll_wait(epfd,evs,MAX_EVENTS,-1);
+        int n=epoll_wait(epfd,evs,MAX_EVENTS,handshakes.empty()?-1:1000); // wake to expire handshakes
         for(int i=0;i<n;++i){int fd=evs[i].data.fd;
             if(fd==listen_sock){
                 sockaddr_in c;
                 socklen_t cl=sizeof(c);
                 int cs=accept(listen_sock,(sockaddr*)&c,&cl);
                 make_socket_non_blocking(cs);
-                epoll_event ce{.events=EPOLLIN|EPOLLET,.data={.fd=cs}};epoll_ctl(epfd,EPOLL_CTL_ADD,cs,&ce);
+                set_no_delay(cs); // replies and pushed events are small frames
+                epoll_event ce{.events=EPOLLIN|EPOLLOUT|EPOLLET,.data={.fd=cs}};epoll_ctl(epfd,EPOLL_CTL_ADD,cs,&ce);
                 logineds.insert({cs,-1});
+                conns[cs].gen=next_conn_gen++;
                 cerr<<"new client with fd="<<fd<<endl;
+            }else if(fd==play_sock){
+                while(true){
+                    int gs=accept(play_sock,nullptr,nullptr);
+                    if(gs<0)break;
+                    make_socket_non_blocking(gs);
+                    set_no_delay(gs); // one snapshot per tick must not wait for the previous one's ACK
+                    epoll_event ge{.events=EPOLLIN|EPOLLET,.data={.fd=gs}};epoll_ctl(epfd,EPOLL_CTL_ADD,gs,&ge);
+                    handshakes[gs].deadline=chrono::steady_clock::now()+HANDSHAKE_TIMEOUT;
+                }
+            }else if(handshakes.count(fd)){
+                route_gameplay(epfd,fd);
+            }else if(fd==dataclient.wake_fd()){
+                dataclient.on_wake();
+            }else if(fd==datafd){
+                if(!dataclient.on_readable()){
+                    epoll_ctl(epfd,EPOLL_CTL_DEL,datafd,nullptr);
+                    close(datafd);
+                }
             }else{
-                string m=recv_message(fd);
-                if(m=="Disconnected"){
+                auto it=conns.find(fd);
+                if(it==conns.end())continue;
+                if(evs[i].events&EPOLLOUT)it->second.out.flush(fd); // socket has room again
+                if(!(evs[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR)))continue;
+                // edge-triggered: drain the socket, then hand over every complete frame
+                FrameReader &in=it->second.in;
+                FrameReader::Status st=in.fill(fd);
+                string m;
+                while(in.next(m)){
+                    // cerr<<m<<endl;
+                    submit_request(fd,m);
+                }
+                if(st!=FrameReader::Open||in.corrupt()){
                     close(fd);
-                    logout_user(fd);
+                    logout_user(logineds[fd]);
                     logineds.erase(fd);
-                    continue;
-                }
-                // cerr<<m<<endl;
-                if(fd==datafd){
-                    cerr<<"unexpected msg from data_server:"<<m<<endl;
-                    continue;
+                    conns.erase(fd);
                 }
-                client_request(fd,m);
             }
         }
+        flush_lobby();
+        if(!handshakes.empty())expire_handshakes(epfd);
     }
 }
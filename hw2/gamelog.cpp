@@ -0,0 +1,85 @@
+#include "gamelog.h"
+#include "utility.h"
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+bool GameLogWriter::open() {
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        cerr << "[GameLog] Cannot open " << path_ << ": " << strerror(errno) << endl;
+        return false;
+    }
+    efd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd_ < 0) {
+        perror("eventfd");
+        return false;
+    }
+    thread_ = thread(&GameLogWriter::run, this);
+    return true;
+}
+
+void GameLogWriter::submit(string line, Tag tag) {
+    unique_lock<mutex> lk(mu_);
+    has_room_.wait(lk, [&] { return queue_.size() < capacity_ || stop_; });
+    queue_.emplace_back(std::move(line), tag);
+    has_work_.notify_one();
+}
+
+vector<pair<GameLogWriter::Tag, bool>> GameLogWriter::completed() {
+    uint64_t n;
+    while (read(efd_, &n, sizeof(n)) > 0) {}
+    lock_guard<mutex> lk(mu_);
+    vector<pair<Tag, bool>> res;
+    res.swap(done_);
+    return res;
+}
+
+void GameLogWriter::run() {
+    vector<pair<string, Tag>> batch;
+    string buf;
+    while (true) {
+        {
+            unique_lock<mutex> lk(mu_);
+            has_work_.wait(lk, [&] { return !queue_.empty() || stop_; });
+            if (queue_.empty()) return; // stopped and drained
+            batch.swap(queue_);
+            has_room_.notify_all();
+        }
+
+        buf.clear();
+        for (auto &[line, tag] : batch) {
+            buf += line;
+            buf += '\n';
+        }
+        bool ok = write_fully(fd_, buf.data(), buf.size()) && (!sync_ || fdatasync(fd_) == 0);
+        if (!ok) cerr << "[GameLog] Writing " << batch.size() << " record(s) failed: " << strerror(errno) << endl;
+
+        {
+            lock_guard<mutex> lk(mu_);
+            for (auto &[line, tag] : batch) done_.emplace_back(tag, ok);
+        }
+        batch.clear();
+        uint64_t one = 1;
+        if (write(efd_, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("eventfd write");
+    }
+}
+
+void GameLogWriter::close() {
+    if (thread_.joinable()) {
+        {
+            lock_guard<mutex> lk(mu_);
+            stop_ = true;
+        }
+        has_work_.notify_one();
+        thread_.join();
+    }
+    if (fd_ >= 0) ::close(fd_);
+    if (efd_ >= 0) ::close(efd_);
+    fd_ = efd_ = -1;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Appends finished-match records to the gamelog (one JSON line each) on its own thread.
+// Everything submitted while the previous batch was being written goes out in one
+// write() and one fdatasync(), so a burst of match ends costs a single disk round trip.
+// Completions are reported through an eventfd the owner polls next to its sockets,
+// so the owner acknowledges each record only once it is on disk and never blocks on I/O.
+class GameLogWriter {
+public:
+    using Tag = uint64_t; // caller's handle for one record, returned by completed()
+
+    // `capacity` records may wait for the writer before submit() blocks.
+    GameLogWriter(const std::string &path, size_t capacity = 4096, bool sync = true)
+        : path_(path), capacity_(capacity), sync_(sync) {}
+    ~GameLogWriter() { close(); }
+
+    // Opens the file (kept open until close()) and starts the writer thread.
+    bool open();
+    void submit(std::string line, Tag tag);
+    // Readable while completed() has results.
+    int event_fd() const { return efd_; }
+    // Records whose batch finished since the last call, with whether it reached the disk.
+    std::vector<std::pair<Tag, bool>> completed();
+    // Writes everything still queued, then stops the thread.
+    void close();
+
+private:
+    void run();
+
+    std::string path_;
+    size_t capacity_;
+    bool sync_;
+    int fd_ = -1, efd_ = -1;
+    std::mutex mu_;
+    std::condition_variable has_work_, has_room_;
+    std::vector<std::pair<std::string, Tag>> queue_;
+    std::vector<std::pair<Tag, bool>> done_;
+    bool stop_ = false;
+    std::thread thread_;
+};
@@ -0,0 +1,528 @@
+// Headless load generator for the lobby and gameplay protocol (COMMUNICATION_PROTOCOL.md).
+// Simulated users come in pairs: the host registers (or logs in), creates a public room and
+// starts it once the guest has joined; both then play over the gameplay port, sending
+// scripted actions at --rate per second until game over, and go again until --duration ends.
+//
+// usage: ./loadgen.out [--users N] [--threads T] [--duration S] [--rate A] [--ramp S]
+//                      [--format full|delta|binary] [--difficulty D] [--prefix P] [--host IP]
+//                      [--lead F] [--tick-rate R] [--ack-budget MS]
+//
+// Every action carries a seq; with --lead F > 0 it also names the tick F past the last
+// snapshot seen, so it waits in the server's input queue instead of applying on arrival.
+//
+// Results are JSON lines on stdout: lobby round-trip percentiles per operation, action to
+// ack percentiles, the kernel's RTT estimate for the gameplay sockets, snapshot inter-arrival
+// percentiles, and counters for connection failures and failed operations. An action is acked
+// as soon as it is applied, so the run exits with status 1 if the ack p99 is more than
+// --ack-budget ms (default 10) above the RTT p99. With --lead the ack waits for the named
+// tick, so that check is skipped.
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <queue>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "utility.h"
+
+using namespace std;
+using json = nlohmann::json;
+using Clock = chrono::steady_clock;
+
+const int GAME_SERVER_PORT = 45632;
+const int GAME_PLAY_PORT = 45633;
+const auto RETRY_DELAY = chrono::milliseconds(250);
+
+struct Options {
+    string host = "127.0.0.1";
+    int users = 100, threads = 0, difficulty = 10, lead = 0, tick_rate = 10;
+    double duration = 30, rate = 5, ramp = 2, ack_budget = 10;
+    string format = "full", prefix = "lg";
+};
+static Options opt;
+
+static atomic<long> g_matches{0}, g_frames{0}, g_failures{0};
+
+static double ms_since(Clock::time_point t) { return chrono::duration<double, milli>(Clock::now() - t).count(); }
+
+struct Stats {
+    map<string, vector<double>> lobby_ms; // round trip per lobby operation
+    vector<double> gap_ms;                // time between consecutive snapshots on one connection
+    vector<double> ack_ms;                // from sending an action to its ack
+    vector<double> rtt_ms;                // kernel smoothed RTT of the gameplay socket, per ack
+    map<string, long> counters;
+
+    void merge(Stats &o) {
+        for (auto &[op, v] : o.lobby_ms) lobby_ms[op].insert(lobby_ms[op].end(), v.begin(), v.end());
+        ack_ms.insert(ack_ms.end(), o.ack_ms.begin(), o.ack_ms.end());
+        rtt_ms.insert(rtt_ms.end(), o.rtt_ms.begin(), o.rtt_ms.end());
+        gap_ms.insert(gap_ms.end(), o.gap_ms.begin(), o.gap_ms.end());
+        for (auto &[k, n] : o.counters) counters[k] += n;
+    }
+};
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    FrameReader in;
+    FrameWriter out;
+};
+
+struct Pair;
+
+struct User {
+    enum State { Offline, Authing, Idle, InRoom, Playing };
+    enum Timer { None, Connect, Create, Join, Start, Act };
+
+    string name;
+    size_t idx = 0; // position in the worker's users_, used as the epoll/timer key
+    Pair *pair = nullptr;
+    bool host = false;
+    State st = Offline;
+    Conn lobby, game;
+    string op; // lobby request awaiting its reply
+    Clock::time_point op_sent;
+    Timer timer = None;
+    Clock::time_point wake;
+    int room_id = -1;
+    bool got_frame = false;
+    Clock::time_point last_frame;
+    size_t script = 0;
+    uint32_t seq = 0;   // last action sent this game
+    int frame_no = 0;   // of the last snapshot
+    map<uint32_t, Clock::time_point> unacked; // seq -> send time
+};
+
+struct Pair {
+    User *host, *guest;
+    int id, round = 0;
+    string room() const { return opt.prefix + "-r" + to_string(id) + "-" + to_string(round); }
+};
+
+static const char *SCRIPT[] = {"Left", "RotateCW", "Right", "SoftDrop", "Left", "Left", "HardDrop",
+                               "Right", "RotateCCW", "Right", "Hold", "SoftDrop", "HardDrop"};
+
+// One thread driving a share of the pairs from its own epoll instance. Timers (connect ramp,
+// retries, action pacing) live in a heap; stale entries are skipped when popped.
+class LoadWorker {
+public:
+    LoadWorker(int first_pair, int pairs, Clock::time_point start, Clock::time_point end)
+        : start_(start), end_(end) {
+        epfd_ = epoll_create1(0);
+        int total = max(1, opt.users / 2);
+        for (int i = 0; i < pairs; ++i) {
+            int id = first_pair + i;
+            auto p = make_unique<Pair>();
+            p->id = id;
+            for (int k = 0; k < 2; ++k) {
+                auto u = make_unique<User>();
+                u->name = opt.prefix + "-u" + to_string(id * 2 + k);
+                u->pair = p.get();
+                u->host = k == 0;
+                u->idx = users_.size();
+                (k == 0 ? p->host : p->guest) = u.get();
+                schedule(u.get(), User::Connect, start + chrono::duration_cast<Clock::duration>(
+                    chrono::duration<double>(opt.ramp * id / total)));
+                users_.push_back(std::move(u));
+            }
+            pairs_.push_back(std::move(p));
+        }
+    }
+
+    ~LoadWorker() { close(epfd_); }
+
+    void run() {
+        epoll_event evs[256];
+        while (Clock::now() < end_) {
+            int timeout = 100;
+            if (!timers_.empty()) {
+                auto ms = chrono::duration_cast<chrono::milliseconds>(timers_.top().first - Clock::now()).count();
+                timeout = (int)max<long>(0, min<long>(ms, 100));
+            }
+            int n = epoll_wait(epfd_, evs, 256, timeout);
+            for (int i = 0; i < n; ++i) {
+                User *u = users_[evs[i].data.u64 >> 1].get();
+                on_event(u, evs[i].data.u64 & 1, evs[i].events);
+            }
+            auto now = Clock::now();
+            while (!timers_.empty() && timers_.top().first <= now) {
+                auto [when, idx] = timers_.top();
+                timers_.pop();
+                User *u = users_[idx].get();
+                if (u->timer == User::None || u->wake != when) continue; // stale entry
+                User::Timer t = u->timer;
+                u->timer = User::None;
+                on_timer(u, t);
+            }
+        }
+        for (auto &u : users_) {
+            drop(u->lobby);
+            drop(u->game);
+        }
+    }
+
+    Stats stats;
+
+private:
+    void schedule(User *u, User::Timer t, Clock::time_point when) {
+        u->timer = t;
+        u->wake = when;
+        timers_.push({when, u->idx});
+    }
+
+    void count(const string &what) {
+        ++stats.counters[what];
+        if (what.find("fail") != string::npos || what.find("closed") != string::npos) ++g_failures;
+    }
+
+    bool open(User *u, Conn &c, int port, bool game) {
+        c.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (c.fd < 0) {
+            count(game ? "game_connect_failed" : "lobby_connect_failed");
+            return false;
+        }
+        make_socket_non_blocking(c.fd);
+        if (game) set_no_delay(c.fd);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+        c.in = FrameReader();
+        c.out = FrameWriter();
+        c.connecting = connect(c.fd, (sockaddr *)&addr, sizeof(addr)) < 0;
+        if (c.connecting && errno != EINPROGRESS) {
+            count(game ? "game_connect_failed" : "lobby_connect_failed");
+            close(c.fd);
+            c.fd = -1;
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u64 = u->idx << 1 | (game ? 1 : 0);
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+        if (!c.connecting) on_connected(u, game);
+        return true;
+    }
+
+    void drop(Conn &c) {
+        if (c.fd < 0) return;
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+        c.connecting = false;
+    }
+
+    void lobby_send(User *u, const string &op, json req) {
+        req["action"] = op;
+        u->op = op;
+        u->op_sent = Clock::now();
+        FrameWriter::Result r = u->lobby.out.send(u->lobby.fd, req.dump());
+        if (r == FrameWriter::Failed || r == FrameWriter::Overflow) lobby_lost(u);
+    }
+
+    void lobby_lost(User *u) {
+        count("lobby_closed");
+        drop(u->lobby);
+        drop(u->game);
+        u->st = User::Offline;
+        u->op.clear();
+        schedule(u, User::Connect, Clock::now() + chrono::seconds(1));
+    }
+
+    void on_connected(User *u, bool game) {
+        Conn &c = game ? u->game : u->lobby;
+        c.connecting = false;
+        if (!game) {
+            u->st = User::Authing;
+            lobby_send(u, "register", {{"name", u->name}, {"password", "pw"}});
+            return;
+        }
+        c.out.send(c.fd, json{{"action", "ready"}, {"name", u->name}, {"room", u->room_id}, {"format", opt.format}}.dump());
+        u->got_frame = false;
+        u->seq = 0;
+        u->frame_no = 0;
+        schedule(u, User::Act, Clock::now());
+    }
+
+    void on_event(User *u, bool game, uint32_t events) {
+        Conn &c = game ? u->game : u->lobby;
+        if (c.fd < 0) return;
+        if (c.connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                count(game ? "game_connect_failed" : "lobby_connect_failed");
+                if (game) game_over(u, false);
+                else lobby_lost(u);
+                return;
+            }
+            on_connected(u, game);
+        }
+        if (events & EPOLLOUT) c.out.flush(c.fd);
+        if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+        FrameReader::Status st = c.in.fill(c.fd);
+        string msg;
+        while (c.fd >= 0 && c.in.next(msg)) {
+            if (game) on_game(u, msg);
+            else on_lobby(u, msg);
+        }
+        if (c.fd >= 0 && (st != FrameReader::Open || c.in.corrupt())) {
+            if (game) {
+                count("game_closed_early");
+                game_over(u, false);
+            } else {
+                lobby_lost(u);
+            }
+        }
+    }
+
+    void on_lobby(User *u, const string &msg) {
+        json j = json::parse(msg, nullptr, false);
+        if (j.is_discarded() || !j.is_object() || j.contains("event")) return; // pushed notifications are ignored
+        if (j.value("action", "") == "start") {
+            u->room_id = j["data"].value("id", -1);
+            u->st = User::Playing;
+            open(u, u->game, GAME_PLAY_PORT, true);
+            return;
+        }
+        if (!j.contains("response") || u->op.empty()) return;
+
+        string op = u->op;
+        u->op.clear();
+        stats.lobby_ms[op].push_back(ms_since(u->op_sent));
+        bool ok = j.value("response", "") == "success";
+        Pair *p = u->pair;
+        auto now = Clock::now();
+
+        if (op == "register" || op == "login") {
+            if (!ok && op == "register") return lobby_send(u, "login", {{"name", u->name}, {"password", "pw"}});
+            if (!ok) {
+                count("login_failed");
+                drop(u->lobby);
+                u->st = User::Offline;
+                return schedule(u, User::Connect, now + chrono::seconds(1));
+            }
+            u->st = User::Idle;
+            if (p->host->st == User::Idle && p->guest->st == User::Idle) schedule(p->host, User::Create, now);
+        } else if (op == "create") {
+            if (!ok) {
+                count("create_failed");
+                ++p->round; // a fresh name in case the old room is still being torn down
+                return schedule(u, User::Create, now + RETRY_DELAY);
+            }
+            u->st = User::InRoom;
+            schedule(p->guest, User::Join, now);
+        } else if (op == "join") {
+            if (!ok) {
+                count("join_failed");
+                return schedule(u, User::Join, now + RETRY_DELAY);
+            }
+            u->st = User::InRoom;
+            schedule(p->host, User::Start, now);
+        } else if (op == "start") {
+            if (!ok) {
+                count("start_failed");
+                schedule(u, User::Start, now + RETRY_DELAY);
+            }
+        }
+    }
+
+    void on_game(User *u, const string &msg) {
+        bool snapshot = msg.empty() || msg[0] != '{';
+        if (!snapshot) {
+            json j = json::parse(msg, nullptr, false);
+            if (j.is_discarded()) return;
+            string action = j.value("action", "");
+            if (action == "game_over") return game_over(u, true);
+            if (action == "error") {
+                count("game_rejected");
+                return game_over(u, false);
+            }
+            if (j.contains("ack")) {
+                auto it = u->unacked.find(j.value("seq", 0u));
+                if (it == u->unacked.end()) return;
+                if (j.contains("rejected")) count("input_rejected");
+                else {
+                    stats.ack_ms.push_back(ms_since(it->second));
+                    tcp_info ti{};
+                    socklen_t len = sizeof(ti);
+                    if (getsockopt(u->game.fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0) stats.rtt_ms.push_back(ti.tcpi_rtt / 1000.0);
+                }
+                u->unacked.erase(it);
+                return;
+            }
+            snapshot = j.contains("f");
+            if (snapshot) u->frame_no = j["f"].get<int>();
+        } else if (msg.size() >= 5) {
+            u->frame_no = (uint8_t)msg[1] << 24 | (uint8_t)msg[2] << 16 | (uint8_t)msg[3] << 8 | (uint8_t)msg[4];
+        }
+        if (!snapshot) return;
+        auto now = Clock::now();
+        if (u->got_frame) stats.gap_ms.push_back(chrono::duration<double, milli>(now - u->last_frame).count());
+        u->got_frame = true;
+        u->last_frame = now;
+        ++g_frames;
+    }
+
+    void game_over(User *u, bool clean) {
+        drop(u->game);
+        u->unacked.clear();
+        if (u->timer == User::Act) u->timer = User::None;
+        u->st = u->lobby.fd >= 0 ? User::Idle : User::Offline;
+        if (clean && u->host) ++g_matches;
+        Pair *p = u->pair;
+        if (p->host->st == User::Idle && p->guest->st == User::Idle) {
+            ++p->round;
+            schedule(p->host, User::Create, Clock::now() + RETRY_DELAY); // the server resets both users asynchronously
+        }
+    }
+
+    void on_timer(User *u, User::Timer t) {
+        Pair *p = u->pair;
+        switch (t) {
+        case User::Connect:
+            if (!open(u, u->lobby, GAME_SERVER_PORT, false)) schedule(u, User::Connect, Clock::now() + chrono::seconds(1));
+            break;
+        case User::Create:
+            lobby_send(u, "create", {{"roomname", p->room()}, {"visibility", "public"}, {"difficulty", opt.difficulty}, {"tickRate", opt.tick_rate}});
+            break;
+        case User::Join:
+            lobby_send(u, "join", {{"roomname", p->room()}});
+            break;
+        case User::Start:
+            lobby_send(u, "start", json::object());
+            break;
+        case User::Act: {
+            if (u->game.fd < 0 || u->game.connecting) break;
+            const char *a = SCRIPT[u->script++ % (sizeof(SCRIPT) / sizeof(SCRIPT[0]))];
+            json act = {{"action", a}, {"seq", ++u->seq}};
+            if (opt.lead > 0) act["frame"] = u->frame_no + opt.lead;
+            u->game.out.send(u->game.fd, act.dump());
+            u->unacked[u->seq] = Clock::now();
+            if (opt.rate > 0)
+                schedule(u, User::Act, Clock::now() + chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / opt.rate)));
+            break;
+        }
+        case User::None:
+            break;
+        }
+    }
+
+    int epfd_;
+    Clock::time_point start_, end_;
+    vector<unique_ptr<Pair>> pairs_;
+    vector<unique_ptr<User>> users_;
+    using Due = pair<Clock::time_point, size_t>;
+    priority_queue<Due, vector<Due>, greater<Due>> timers_;
+};
+
+static json percentiles(vector<double> v) {
+    if (v.empty()) return {{"count", 0}};
+    sort(v.begin(), v.end());
+    auto at = [&](double q) { return v[min(v.size() - 1, (size_t)(q * v.size()))]; };
+    return {{"count", v.size()}, {"p50", at(0.50)}, {"p90", at(0.90)}, {"p99", at(0.99)}, {"max", v.back()}};
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string k = argv[i], v = argv[i + 1];
+        if (k == "--users") opt.users = stoi(v);
+        else if (k == "--threads") opt.threads = stoi(v);
+        else if (k == "--duration") opt.duration = stod(v);
+        else if (k == "--rate") opt.rate = stod(v);
+        else if (k == "--ramp") opt.ramp = stod(v);
+        else if (k == "--format") opt.format = v;
+        else if (k == "--difficulty") opt.difficulty = stoi(v);
+        else if (k == "--prefix") opt.prefix = v;
+        else if (k == "--host") opt.host = v;
+        else if (k == "--lead") opt.lead = stoi(v);
+        else if (k == "--tick-rate") opt.tick_rate = stoi(v);
+        else if (k == "--ack-budget") opt.ack_budget = stod(v);
+        else {
+            cerr << "[LoadGen] Unknown option " << k << endl;
+            return 2;
+        }
+    }
+    int pairs = max(1, opt.users / 2);
+    int threads = opt.threads > 0 ? opt.threads : (int)max(1u, thread::hardware_concurrency());
+    threads = min(threads, pairs);
+
+    // two sockets per user plus slack
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)pairs * 4 + 64)
+        cerr << "[LoadGen] Warning: fd limit " << rl.rlim_cur << " is below the " << pairs * 4 + 64 << " sockets this run needs" << endl;
+
+    cerr << "[LoadGen] " << pairs * 2 << " users (" << pairs << " pairs) on " << threads << " thread(s) for "
+         << opt.duration << " s, " << opt.rate << " actions/s, format " << opt.format << endl;
+
+    auto start = Clock::now();
+    auto end = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(opt.duration));
+    vector<unique_ptr<LoadWorker>> workers;
+    for (int t = 0, first = 0; t < threads; ++t) {
+        int n = pairs / threads + (t < pairs % threads ? 1 : 0);
+        workers.push_back(make_unique<LoadWorker>(first, n, start, end));
+        first += n;
+    }
+    vector<thread> pool;
+    for (auto &w : workers) pool.emplace_back(&LoadWorker::run, w.get());
+
+    while (Clock::now() < end) {
+        this_thread::sleep_for(chrono::milliseconds(min<long>(5000, max<long>(1, chrono::duration_cast<chrono::milliseconds>(end - Clock::now()).count()))));
+        cerr << "[LoadGen] t=" << (int)(ms_since(start) / 1000) << "s matches=" << g_matches << " frames=" << g_frames
+             << " failures=" << g_failures << endl;
+    }
+    for (auto &t : pool) t.join();
+
+    Stats all;
+    for (auto &w : workers) all.merge(w->stats);
+    for (auto &[op, v] : all.lobby_ms) {
+        json line = percentiles(v);
+        line["metric"] = "lobby_ms";
+        line["op"] = op;
+        cout << line.dump() << endl;
+    }
+    json acks = percentiles(all.ack_ms);
+    acks["metric"] = "ack_ms";
+    cout << acks.dump() << endl;
+    json rtts = percentiles(all.rtt_ms);
+    rtts["metric"] = "rtt_ms";
+    cout << rtts.dump() << endl;
+    json gaps = percentiles(all.gap_ms);
+    gaps["metric"] = "snapshot_gap_ms";
+    cout << gaps.dump() << endl;
+    json counters = {{"metric", "counters"}, {"matches", g_matches.load()}, {"frames", g_frames.load()}};
+    for (auto &[k, n] : all.counters) counters[k] = n;
+    cout << counters.dump() << endl;
+
+    // acks leave the server the moment an action is applied, so they should cost one round trip;
+    // a led action is only applied at its tick, --lead ticks later
+    bool ack_ok = true;
+    if (opt.lead > 0) {
+        cout << json{{"metric", "ack_over_rtt_ms"}, {"skipped", "lead"}}.dump() << endl;
+    } else if (!all.ack_ms.empty() && !all.rtt_ms.empty()) {
+        double over = acks["p99"].get<double>() - rtts["p99"].get<double>();
+        ack_ok = over <= opt.ack_budget;
+        cout << json{{"metric", "ack_over_rtt_ms"}, {"p99", over}, {"budget", opt.ack_budget}, {"ok", ack_ok}}.dump() << endl;
+        if (!ack_ok) cerr << "[LoadGen] Ack p99 is " << over << " ms above the RTT p99, budget " << opt.ack_budget << " ms" << endl;
+    }
+    return ack_ok ? 0 : 1;
+}
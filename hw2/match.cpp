@@ -0,0 +1,645 @@
+#include "match.h"
+#include "session.h"
+#include <algorithm>
+#include <iostream>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+static const auto CLOSE_GRACE = 100ms;   // time clients get to read game_over before we close
+static const auto CONNECT_TIMEOUT = 30s; // a match whose players have not both connected by then is abandoned
+
+// ===================== Match =====================
+
+Match::Match(json room, json pA, json pB, DataClient &dc)
+    : room_(std::move(room)), pA_(std::move(pA)), pB_(std::move(pB)), dc_(dc) {
+    room_name_ = room_.value("name", "");
+    host_user_ = room_.value("hostUser", "");
+    oppo_user_ = room_.value("oppoUser", "");
+    room_id_ = room_.value("id", 0);
+    tick_rate_ = min(60, max(5, room_.value("tickRate", 10))); // the data server clamps it too
+    tick_ = duration_cast<Clock::duration>(seconds(1)) / tick_rate_;
+}
+
+Match::~Match() { close_all(); }
+
+void Match::open(MatchWorker &w) {
+    worker_ = &w;
+    cout << "[TetrisGameServer] Starting game for room '" << room_name_ << "' (id=" << room_id_ << ") - Players: " << host_user_ << " vs " << oppo_user_ << endl;
+    cout << "[TetrisGameServer] Waiting for 2 players to connect..." << endl;
+
+    // Update room status to "playing"
+    room_["status"] = "playing";
+    dc_.request(json{{"action", "update"}, {"type", "room"}, {"data", room_}}, [](json) {});
+
+    // start() replaces this deadline, so it only fires while still Waiting
+    next_due_ = Clock::now() + CONNECT_TIMEOUT;
+    w.schedule(this);
+}
+
+void Match::attach(int fd, const string &hello, FrameReader in) {
+    readers_[fd] = std::move(in);
+    worker_->watch(fd, this, EPOLLIN | EPOLLOUT | EPOLLET);
+    if (!handshake(fd, hello)) return;
+    consume(fd, FrameReader::Open); // frames that arrived right behind the handshake
+}
+
+void Match::on_event(int fd, uint32_t events) {
+    if (events & EPOLLOUT) {
+        auto w = writers_.find(fd);
+        if (w != writers_.end()) w->second.flush(fd);
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) return;
+
+    auto rit = readers_.find(fd);
+    if (rit == readers_.end()) return;
+    consume(fd, rit->second.fill(fd));
+}
+
+void Match::consume(int fd, FrameReader::Status st) {
+    FrameReader &in = readers_.at(fd);
+    string msg;
+    while (in.next(msg)) {
+        if (fd != p1_fd_ && fd != p2_fd_) continue; // Spectators' actions are ignored
+        try {
+            on_input(fd, json::parse(msg));
+        } catch (const exception &e) {
+            cerr << "[TetrisGameServer] JSON parse error: " << e.what() << endl;
+        }
+    }
+    if (st == FrameReader::Open && !in.corrupt()) return;
+
+    // Check if it's a player or spectator
+    if (fd == p1_fd_ || fd == p2_fd_) {
+        if (phase_ == Running) {
+            cout << "[TetrisGameServer] Player disconnected (fd=" << fd << "). Ending game." << endl;
+            finish(true, fd);
+        } else if (phase_ == Waiting) {
+            cout << "[TetrisGameServer] Player left before the match started (fd=" << fd << ")" << endl;
+            if (fd == p1_fd_) p1_fd_ = -1;
+            else p2_fd_ = -1;
+            drop(fd);
+        }
+        return;
+    }
+    bool spectator = find(spectator_fds_.begin(), spectator_fds_.end(), fd) != spectator_fds_.end();
+    drop(fd);
+    if (spectator)
+        cout << "[TetrisGameServer] Spectator disconnected (fd=" << fd << "), remaining: " << spectator_fds_.size() << endl;
+}
+
+// An action may carry "seq" (strictly increasing per player) and "frame", the tick it
+// is meant for. Without a frame, or one already due, it is applied right away and
+// counted in the coming tick; a later frame waits in the player's queue for that tick.
+// Anything behind a queued input queues too, so a player's inputs are applied in seq
+// order. Every action gets one ack, once applied or rejected.
+void Match::on_input(int fd, const json &msg) {
+    int player = fd == p1_fd_ ? 0 : 1;
+    InputQueue &q = inputs_[player];
+    bool has_seq = msg.contains("seq");
+    uint32_t seq = msg.value("seq", 0u);
+    Tetris::Action a = parse_action(msg.value("action", ""));
+
+    if (phase_ != Running || a == Tetris::Action::None) {
+        json ack = {{"ack", frame_ + 1}};
+        if (has_seq) ack["seq"] = seq;
+        writers_.at(fd).send(fd, ack.dump());
+        return;
+    }
+    if (has_seq) {
+        if (seq <= q.last_seq) return reject_input(fd, seq, "stale seq");
+        q.last_seq = seq;
+    }
+    int target = msg.value("frame", frame_ + 1);
+    if (target > frame_ + INPUT_MAX_LEAD) return reject_input(fd, seq, "frame too far ahead");
+    if (target <= frame_ + 1 && q.pending.empty()) return apply_input(player, a, seq, has_seq);
+    if (q.pending.size() >= INPUT_QUEUE_LIMIT) return reject_input(fd, seq, "input queue full");
+    if (!q.pending.empty()) target = max(target, q.pending.back().frame);
+    q.pending.push_back({seq, has_seq, target, a});
+}
+
+void Match::reject_input(int fd, uint32_t seq, const char *reason) {
+    writers_.at(fd).send(fd, json{{"ack", frame_ + 1}, {"seq", seq}, {"rejected", reason}}.dump());
+}
+
+// Steps `player`'s game, stamped with the coming tick for the replay (the same sequence
+// of engine steps as applying it at the start of that tick), and acks with the
+// player's own state, so a move is seen after one round trip instead of at the next
+// snapshot.
+void Match::apply_input(int player, Tetris::Action a, uint32_t seq, bool has_seq) {
+    int fd = player == 0 ? p1_fd_ : p2_fd_;
+    Tetris &game = player == 0 ? *game1_ : *game2_;
+    const string &name = player == 0 ? host_user_ : oppo_user_;
+    json ack = {{"ack", frame_ + 1}};
+    if (has_seq) {
+        ack["seq"] = seq;
+        inputs_[player].applied_seq = seq;
+    }
+    if (viewers_.at(fd).format == SnapshotStream::Delta) {
+        // just what this action changed, in the delta format's keys
+        SnapshotStream::View before = SnapshotStream::view_of(game);
+        game.step(a);
+        ack[name] = SnapshotStream::diff(before, SnapshotStream::view_of(game));
+    } else {
+        game.step(a);
+        ack[name] = game.to_json();
+    }
+    replay_.record(player, frame_ + 1, a);
+    writers_.at(fd).send(fd, ack.dump());
+}
+
+bool Match::handshake(int fd, const string &hello) {
+    auto reject = [&](const string &reason) {
+        FrameWriter().send(fd, json{{"action", "error"}, {"reason", reason}}.dump());
+        drop(fd);
+    };
+    json payload;
+    try {
+        payload = json::parse(hello);
+    } catch (const std::exception &e) {
+        cerr << "[TetrisGameServer] Invalid handshake JSON from fd=" << fd << ": " << e.what() << endl;
+        drop(fd);
+        return false;
+    }
+
+    string action = payload.value("action", "");
+    string name = payload.value("name", "");
+    SnapshotStream::Format format;
+    if (!SnapshotStream::parse_format(payload.value("format", "full"), format)) {
+        cerr << "[TetrisGameServer] Unknown snapshot format from fd=" << fd << ", closing.\n";
+        reject("unknown format");
+        return false;
+    }
+    if (action == "ready") {
+        if (name == host_user_ && p1_fd_ < 0) {
+            p1_fd_ = fd;
+            cout << "[TetrisGameServer] Host player '" << name << "' ready (fd=" << fd << ")\n";
+        } else if (name == oppo_user_ && p2_fd_ < 0) {
+            p2_fd_ = fd;
+            cout << "[TetrisGameServer] Opponent player '" << name << "' ready (fd=" << fd << ")\n";
+        } else {
+            cerr << "[TetrisGameServer] Unexpected player handshake from '" << name
+                 << "' (fd=" << fd << "). Closing connection.\n";
+            reject("not part of this match");
+            return false;
+        }
+        writers_.emplace(fd, FrameWriter(PLAYER_HIGH_WATER, PLAYER_HARD_LIMIT));
+        viewers_[fd].format = format;
+        if (p1_fd_ >= 0 && p2_fd_ >= 0 && phase_ == Waiting) start();
+    } else if (action == "spectate") {
+        add_spectator(fd);
+        viewers_[fd].format = format;
+        cout << "[TetrisGameServer] Spectator '" << name << "' connected (fd=" << fd << "), total spectators: " << spectator_fds_.size() << endl;
+    } else {
+        cerr << "[TetrisGameServer] Unknown handshake action '" << action
+             << "' from fd=" << fd << ", closing.\n";
+        reject("invalid handshake");
+        return false;
+    }
+    return true;
+}
+
+void Match::add_spectator(int fd) {
+    writers_.emplace(fd, FrameWriter(SPECTATOR_HIGH_WATER, SPECTATOR_HARD_LIMIT));
+    spectator_fds_.push_back(fd);
+}
+
+void Match::drop(int fd) {
+    auto it = find(spectator_fds_.begin(), spectator_fds_.end(), fd);
+    if (it != spectator_fds_.end()) spectator_fds_.erase(it);
+    readers_.erase(fd);
+    writers_.erase(fd);
+    viewers_.erase(fd);
+    worker_->unwatch(fd);
+    close(fd);
+}
+
+void Match::start() {
+    cout << "[TetrisGameServer] Both players connected: host fd=" << p1_fd_ << ", opponent fd=" << p2_fd_ << endl;
+
+    // Initialize games with seed (use room_id for deterministic seeding, or add custom seed)
+    uint32_t seed = room_.value("seed", static_cast<uint32_t>(room_id_));
+    int difficulty = room_.value("difficulty", 10); // Default: 10 frames = easy, lower = harder
+    game1_ = make_unique<Tetris>(seed, difficulty, tick_rate_);
+    game2_ = make_unique<Tetris>(seed, difficulty, tick_rate_);
+    replay_.seed = seed;
+    replay_.difficulty = difficulty;
+    replay_.tick_rate = tick_rate_;
+    stream_.keyframe_interval = spec_stream_.keyframe_interval = 5 * tick_rate_; // every 5 s
+
+    phase_ = Running;
+    next_due_ = Clock::now();
+    worker_->schedule(this);
+    cout << "[TetrisGameServer] Game started! with p1=" << host_user_ << ", and p2=" << oppo_user_
+         << " at " << tick_rate_ << " ticks/s" << endl;
+}
+
+void Match::on_due() {
+    if (phase_ == Running) tick();
+    else if (phase_ == Waiting) abandon();
+    else if (phase_ == Closing) {
+        close_all();
+        phase_ = Done;
+    }
+}
+
+void Match::tick() {
+    // --- 1️⃣ Apply queued inputs aimed at this frame ---
+    // (the others were applied on arrival, see on_input())
+    for (int player = 0; player < 2; ++player) {
+        auto &pending = inputs_[player].pending;
+        while (!pending.empty() && pending.front().frame <= frame_ + 1) {
+            Input in = pending.front();
+            pending.pop_front();
+            apply_input(player, in.action, in.seq, in.has_seq);
+        }
+    }
+    frame_++;
+    replay_.frames = frame_;
+
+    // --- 2️⃣ Advance both games ---
+    // Let the Tetris engine handle auto-dropping internally based on its timed dropTimer
+    game1_->step(Tetris::Action::None);
+    game2_->step(Tetris::Action::None);
+
+    // --- 3️⃣ Send frame snapshot to players and spectators ---
+    // Each format is encoded and framed at most once per frame and shared by every recipient, see SnapshotStream
+    vector<pair<string, const Tetris *>> games = {{host_user_, game1_.get()}, {oppo_user_, game2_.get()}};
+    vector<uint32_t> seqs = {inputs_[0].applied_seq, inputs_[1].applied_seq};
+    stream_.capture(frame_, games, seqs);
+
+    // Send to players; a snapshot is dropped rather than queued behind a full buffer
+    send_snapshot(p1_fd_, stream_);
+    send_snapshot(p2_fd_, stream_);
+
+    // Send to all spectators, on their own (possibly slower) schedule; the last frame always goes out
+    bool over = game1_->state().gameOver || game2_->state().gameOver;
+    if (!spectator_fds_.empty() && (frame_ % spectator_every() == 0 || over)) {
+        spec_stream_.capture(frame_, games, seqs);
+        for (size_t i = 0; i < spectator_fds_.size(); ) {
+            int spec_fd = spectator_fds_[i];
+            FrameWriter::Result r = send_snapshot(spec_fd, spec_stream_);
+            if (r == FrameWriter::Overflow || r == FrameWriter::Failed) {
+                // Spectator stopped reading or disconnected, remove from list
+                cout << "[TetrisGameServer] Spectator (fd=" << spec_fd << ") send failed, removing" << endl;
+                drop(spec_fd);
+                continue;
+            }
+            ++i;
+        }
+    }
+
+    // --- 4️⃣ End condition ---
+    if (over) {
+        finish(false, -1);
+        return;
+    }
+
+    // --- 5️⃣ Maintain steady tick rate ---
+    next_due_ += tick_;
+    if (next_due_ < Clock::now()) next_due_ = Clock::now(); // overloaded: don't burst to catch up
+    worker_->schedule(this);
+}
+
+// Ticks between spectator snapshots: SPECTATOR_RATE per second at most, halved for a
+// large audience, so a fast room or a crowd does not multiply the fan-out cost.
+int Match::spectator_every() const {
+    int rate = spectator_fds_.size() > SPECTATOR_FANOUT ? SPECTATOR_RATE / 2 : SPECTATOR_RATE;
+    return max(1, (tick_rate_ + rate - 1) / rate);
+}
+
+FrameWriter::Result Match::send_snapshot(int fd, SnapshotStream &stream) {
+    Viewer &v = viewers_.at(fd);
+    const SnapshotStream::Frame &msg = v.format == SnapshotStream::Full ? stream.full()
+                      : v.format == SnapshotStream::Binary ? stream.binary()
+                      : (v.synced && !stream.keyframe_due()) ? stream.delta()
+                      : stream.keyframe();
+    FrameWriter::Result r = writers_.at(fd).send(fd, msg, true);
+    v.synced = (r == FrameWriter::Sent || r == FrameWriter::Queued); // a skipped frame breaks the delta chain
+    return r;
+}
+
+void Match::finish(bool player_disconnected, int disconnected_fd) {
+    cout << "[TetrisGameServer] Cleaning up game for room '" << room_name_ << "'" << endl;
+
+    // Send final game over notification to both players
+    // Each player sees their own result as "my_result" and opponent as "opponent_result"
+    bool p1_won = player_disconnected ? (disconnected_fd == p2_fd_) : game2_->state().gameOver; // p1 wins if p2 tops out or disconnects
+    bool p2_won = player_disconnected ? (disconnected_fd == p1_fd_) : game1_->state().gameOver;
+
+    json game_over_p1 = {
+        {"action", "game_over"},
+        {"won", p1_won},
+        {"my_result", game1_->result_json()},
+        {"opponent_result", game2_->result_json()}
+    };
+
+    json game_over_p2 = {
+        {"action", "game_over"},
+        {"won", p2_won},
+        {"my_result", game2_->result_json()},
+        {"opponent_result", game1_->result_json()}
+    };
+
+    if (player_disconnected) {
+        game_over_p1["aborted"] = true;
+        game_over_p2["aborted"] = true;
+    }
+
+    writers_.at(p1_fd_).send(p1_fd_, game_over_p1.dump());
+    writers_.at(p2_fd_).send(p2_fd_, game_over_p2.dump());
+
+    bool completed = !player_disconnected && (game1_->state().gameOver || game2_->state().gameOver);
+    if (!completed)
+        cout << "[TetrisGameServer] Game aborted before completion; skipping save to data server." << endl;
+    cleanup(completed);
+
+    // Give clients time to process the message before closing
+    phase_ = Closing;
+    next_due_ = Clock::now() + CLOSE_GRACE;
+    worker_->schedule(this);
+}
+
+// Both players did not connect in time: tell whoever did, then free the room and
+// everyone's status as for an aborted game, so the room can be started again.
+void Match::abandon() {
+    cout << "[TetrisGameServer] Room '" << room_name_ << "': players did not connect within "
+         << CONNECT_TIMEOUT.count() << " s, abandoning the match" << endl;
+    for (int fd : {p1_fd_, p2_fd_})
+        if (fd >= 0) writers_.at(fd).send(fd, json{{"action", "error"}, {"reason", "opponent did not connect"}}.dump());
+    cleanup(false);
+    phase_ = Closing;
+    next_due_ = Clock::now() + CLOSE_GRACE;
+    worker_->schedule(this);
+}
+
+// Reset everyone's status, save the gamelog and delete the room: one room query (for
+// the current spectator list and the gamelog's copy of the room), then one batch with
+// everything else. Callbacks run on the lobby thread, so they only capture copies.
+void Match::cleanup(bool save) {
+    DataClient &dc = dc_;
+    json gamelog;
+    if (save) // only a finished game has results; an abandoned one never created its engines
+        gamelog = {
+            {"action", "create"},
+            {"type", "gamelog"},
+            {"data", {
+                {"hostUser", host_user_},
+                {"oppoUser", oppo_user_},
+                {"host_result", game1_->result_json()},
+                {"oppo_result", game2_->result_json()},
+                {"replay", replay_.to_json()}
+            }}
+        };
+    vector<int> players = {pA_.value("id", -1), pB_.value("id", -1)}; //pA pB doesn't ensure who is host
+
+    dc.request(json{{"action", "query"}, {"type", "room"}, {"id", room_id_}},
+               [&dc, room = room_, gamelog, players, save](json room_query) mutable {
+        // Only the changed fields are sent, the data server keeps the rest of each record;
+        // this callback runs on the lobby thread, so the session cache is patched as well
+        vector<int> reset;
+        auto back_to_lobby = [&reset](int id) {
+            reset.push_back(id);
+            return sessions.update(id, {{"status", "idle"}, {"roomName", "-1"}});
+        };
+        json ops = json::array();
+        if (room_query.value("response", "failed") == "success" && room_query.contains("data")) {
+            room = room_query["data"];
+            if (room.contains("specList") && room["specList"].is_array()) {
+                for (auto &spec_entry : room["specList"])
+                    if (spec_entry.is_number_integer() && spec_entry.get<int>() >= 0) ops.push_back(back_to_lobby(spec_entry.get<int>()));
+            }
+        } else {
+            cerr << "[TetrisGameServer] Failed to re-query room for cleanup: " << room_query.dump() << endl;
+        }
+        if (save) {
+            gamelog["data"]["room"] = room;
+            ops.push_back(gamelog);
+        }
+
+        // Delete the room after game over
+        ops.push_back(json{{"action", "delete"}, {"type", "room"}, {"data", room.value("name", "")}});
+        for (int id : players)
+            if (id >= 0) ops.push_back(back_to_lobby(id));
+
+        size_t n = ops.size();
+        dc.request(json{{"action", "batch"}, {"ops", std::move(ops)}}, [n, reset](json res) {
+            for (int id : reset) sessions.settled(id, res);
+            if (res.value("response", "failed") != "success")
+                cerr << "[TetrisGameServer] Cleanup batch of " << n << " operation(s) incomplete: " << res.dump() << endl;
+        });
+    });
+}
+
+void Match::close_all() {
+    for (auto &[fd, w] : writers_) w.flush(fd); // last chance for game_over
+    vector<int> fds;
+    for (auto &[fd, r] : readers_) fds.push_back(fd);
+    for (int fd : fds) drop(fd);
+    p1_fd_ = p2_fd_ = -1;
+}
+
+// ===================== MatchWorker =====================
+
+MatchWorker::MatchWorker(MatchScheduler &sched, int index, int cpu) : sched_(sched), index_(index) {
+    epfd_ = epoll_create1(0);
+    timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    wakefd_ = eventfd(0, EFD_NONBLOCK);
+    if (epfd_ < 0 || timerfd_ < 0 || wakefd_ < 0) {
+        perror("[MatchWorker] failed to create epoll/timerfd/eventfd");
+        exit(1);
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = timerfd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, timerfd_, &ev);
+    ev.data.fd = wakefd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev);
+    thread_ = thread(&MatchWorker::run, this, cpu);
+}
+
+MatchWorker::~MatchWorker() {
+    stop_ = true;
+    uint64_t one = 1;
+    if (write(wakefd_, &one, sizeof(one)) < 0) perror("[MatchWorker] wake");
+    if (thread_.joinable()) thread_.join();
+    matches_.clear();
+    close(epfd_);
+    close(timerfd_);
+    close(wakefd_);
+}
+
+void MatchWorker::adopt(unique_ptr<Match> m) {
+    {
+        lock_guard<mutex> lk(inbox_mu_);
+        inbox_.push_back(std::move(m));
+    }
+    ++load_;
+    uint64_t one = 1;
+    if (write(wakefd_, &one, sizeof(one)) < 0) perror("[MatchWorker] wake");
+}
+
+void MatchWorker::route(int room_id, int fd, string hello, FrameReader in) {
+    {
+        lock_guard<mutex> lk(inbox_mu_);
+        arrivals_.push_back({room_id, fd, std::move(hello), std::move(in)});
+    }
+    uint64_t one = 1;
+    if (write(wakefd_, &one, sizeof(one)) < 0) perror("[MatchWorker] wake");
+}
+
+void MatchWorker::watch(int fd, Match *m, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("[MatchWorker] epoll_ctl ADD failed");
+        return;
+    }
+    owners_[fd] = m;
+}
+
+void MatchWorker::unwatch(int fd) {
+    if (owners_.erase(fd)) epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void MatchWorker::schedule(Match *m) { due_.push({m->next_due(), m->id}); }
+
+void MatchWorker::run(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        cerr << "[MatchWorker] Could not pin worker " << index_ << " to cpu " << cpu << endl;
+
+    epoll_event evs[64];
+    while (!stop_) {
+        int n = epoll_wait(epfd_, evs, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[MatchWorker] epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = evs[i].data.fd;
+            uint64_t count;
+            if (fd == wakefd_) {
+                if (read(wakefd_, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("[MatchWorker] read wakefd");
+                take_inbox();
+            } else if (fd == timerfd_) {
+                if (read(timerfd_, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("[MatchWorker] read timerfd");
+            } else {
+                auto it = owners_.find(fd);
+                if (it != owners_.end()) it->second->on_event(fd, evs[i].events);
+            }
+        }
+        run_due();
+        rearm();
+    }
+}
+
+void MatchWorker::take_inbox() {
+    vector<unique_ptr<Match>> fresh;
+    vector<Arrival> arrived;
+    {
+        lock_guard<mutex> lk(inbox_mu_);
+        fresh.swap(inbox_);
+        arrived.swap(arrivals_);
+    }
+    // matches first: a connection can only be routed here after its match was adopted
+    for (auto &m : fresh) {
+        Match *raw = m.get();
+        raw->id = next_id_++;
+        rooms_[raw->room_id()] = raw->id;
+        matches_[raw->id] = std::move(m);
+        raw->open(*this);
+    }
+    for (auto &a : arrived) {
+        auto r = rooms_.find(a.room_id);
+        if (r == rooms_.end()) {
+            // the match ended between routing and now
+            FrameWriter().send(a.fd, json{{"action", "error"}, {"reason", "no such match"}}.dump());
+            close(a.fd);
+            continue;
+        }
+        matches_.at(r->second)->attach(a.fd, a.hello, std::move(a.in));
+    }
+}
+
+void MatchWorker::run_due() {
+    auto now = Clock::now();
+    while (!due_.empty() && due_.top().first <= now) {
+        auto [when, id] = due_.top();
+        due_.pop();
+        auto it = matches_.find(id);
+        if (it == matches_.end() || it->second->next_due() != when) continue; // stale entry
+        Match *m = it->second.get();
+        m->on_due();
+        if (m->phase() == Match::Done) {
+            rooms_.erase(m->room_id());
+            sched_.forget(m->room_id(), this);
+            matches_.erase(it);
+            --load_;
+        }
+    }
+}
+
+void MatchWorker::rearm() {
+    itimerspec its{};
+    if (!due_.empty()) {
+        auto ns = duration_cast<nanoseconds>(due_.top().first.time_since_epoch()).count();
+        if (ns <= 0) ns = 1;
+        // steady_clock is CLOCK_MONOTONIC on Linux, so the deadline can be used as an absolute time
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
+// ===================== MatchScheduler =====================
+
+MatchScheduler::MatchScheduler(DataClient &dc, int workers) : dc_(dc) {
+    int cpus = max(1u, thread::hardware_concurrency());
+    if (workers <= 0) workers = cpus;
+    for (int i = 0; i < workers; ++i)
+        workers_.push_back(make_unique<MatchWorker>(*this, i, i % cpus));
+    cout << "[MatchScheduler] " << workers << " match worker(s) ready" << endl;
+}
+
+bool MatchScheduler::launch(json room, json pA, json pB) {
+    int room_id = room.value("id", 0);
+    MatchWorker *best = workers_.front().get();
+    for (auto &w : workers_)
+        if (w->load() < best->load()) best = w.get();
+    {
+        lock_guard<mutex> lk(rooms_mu_);
+        if (!rooms_.emplace(room_id, best).second) return false;
+    }
+    best->adopt(make_unique<Match>(std::move(room), std::move(pA), std::move(pB), dc_));
+    return true;
+}
+
+bool MatchScheduler::route(int room_id, int fd, string hello, FrameReader in) {
+    MatchWorker *w;
+    {
+        lock_guard<mutex> lk(rooms_mu_);
+        auto it = rooms_.find(room_id);
+        if (it == rooms_.end()) return false;
+        w = it->second;
+    }
+    w->route(room_id, fd, std::move(hello), std::move(in));
+    return true;
+}
+
+void MatchScheduler::forget(int room_id, MatchWorker *w) {
+    lock_guard<mutex> lk(rooms_mu_);
+    auto it = rooms_.find(room_id);
+    if (it != rooms_.end() && it->second == w) rooms_.erase(it);
+}
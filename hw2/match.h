@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "data_client.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "tetris.h"
+#include "utility.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+// Outbound queue limits (bytes) for match connections, see FrameWriter.
+const size_t PLAYER_HIGH_WATER = 64 * 1024, PLAYER_HARD_LIMIT = 1024 * 1024;
+const size_t SPECTATOR_HIGH_WATER = 32 * 1024, SPECTATOR_HARD_LIMIT = 256 * 1024;
+// Player inputs aimed at a later tick wait in a queue of at most this many,
+// and may aim at most this many ticks ahead.
+const size_t INPUT_QUEUE_LIMIT = 32;
+const int INPUT_MAX_LEAD = 20;
+// Spectators get at most SPECTATOR_RATE snapshots per second, whatever the room's tick
+// rate, and half as many once a match has more than SPECTATOR_FANOUT of them.
+const int SPECTATOR_RATE = 10;
+const size_t SPECTATOR_FANOUT = 32;
+
+class MatchWorker;
+class MatchScheduler;
+
+// One Tetris match: its sockets, both engines and the end-of-match cleanup.
+// A match never blocks; it is driven entirely by its MatchWorker's events and ticks.
+// Player actions are applied as they arrive (or at the tick they name) and acknowledged
+// to the sender; ticks only add gravity and broadcast the snapshot.
+class Match {
+public:
+    enum Phase { Waiting, Running, Closing, Done };
+
+    Match(json room, json pA, json pB, DataClient &dc);
+    ~Match();
+
+    // Called once by the adopting worker before any connection is attached.
+    void open(MatchWorker &w);
+    // Take over a gameplay connection whose handshake frame `hello` was already read;
+    // `in` holds anything the client sent after it.
+    void attach(int fd, const std::string &hello, FrameReader in);
+    void on_event(int fd, uint32_t events);
+    // Called when next_due has passed: steps both games, abandons a match still waiting
+    // for its players, or finishes closing.
+    void on_due();
+
+    uint64_t id = 0; // assigned by the worker that adopts the match
+
+    Phase phase() const { return phase_; }
+    Clock::time_point next_due() const { return next_due_; }
+    int room_id() const { return room_id_; }
+
+private:
+    bool handshake(int fd, const std::string &hello);
+    void consume(int fd, FrameReader::Status st);
+    void on_input(int fd, const json &msg);
+    void apply_input(int player, Tetris::Action a, uint32_t seq, bool has_seq);
+    void reject_input(int fd, uint32_t seq, const char *reason);
+    void start();
+    void tick();
+    void finish(bool player_disconnected, int disconnected_fd);
+    void abandon();
+    void cleanup(bool save);
+    void add_spectator(int fd);
+    FrameWriter::Result send_snapshot(int fd, SnapshotStream &stream);
+    int spectator_every() const;
+    void drop(int fd);
+    void close_all();
+
+    json room_, pA_, pB_;
+    DataClient &dc_;
+    MatchWorker *worker_ = nullptr;
+    std::string room_name_, host_user_, oppo_user_;
+    int room_id_;
+    int tick_rate_;            // the room's "tickRate"
+    Clock::duration tick_;     // 1 s / tick_rate_
+
+    Phase phase_ = Waiting;
+    Clock::time_point next_due_{};
+    int p1_fd_ = -1, p2_fd_ = -1;
+    std::vector<int> spectator_fds_;
+    std::unordered_map<int, FrameReader> readers_; // partial input frames kept across wakeups
+    std::unordered_map<int, FrameWriter> writers_;
+    struct Viewer {
+        SnapshotStream::Format format = SnapshotStream::Full;
+        bool synced = false; // got the previous frame, so a delta is enough
+    };
+    std::unordered_map<int, Viewer> viewers_; // snapshot format negotiated in the handshake
+
+    // One player's inputs that named a tick still to come, in seq order.
+    struct Input {
+        uint32_t seq;
+        bool has_seq;
+        int frame;
+        Tetris::Action action;
+    };
+    struct InputQueue {
+        std::deque<Input> pending;
+        uint32_t last_seq = 0;     // highest seq accepted, later ones must be above it
+        uint32_t applied_seq = 0;  // echoed in snapshots
+    };
+    InputQueue inputs_[2]; // host, opponent
+
+    std::unique_ptr<Tetris> game1_, game2_;
+    SnapshotStream stream_;      // every tick, for the players
+    SnapshotStream spec_stream_; // every spectator_every() ticks, its deltas span those ticks
+    Replay replay_; // seed, difficulty and frame-stamped inputs, saved with the gamelog
+    int frame_ = 0;
+};
+
+// A pinned thread driving many matches from one epoll instance and one timerfd.
+// The timerfd is armed for the earliest due match; each expiry steps every match that is due.
+class MatchWorker {
+public:
+    MatchWorker(MatchScheduler &sched, int index, int cpu);
+    ~MatchWorker();
+
+    // Thread-safe: hand a new match to this worker.
+    void adopt(std::unique_ptr<Match> m);
+    // Thread-safe: hand a handshaken gameplay connection to this worker's match for `room_id`.
+    void route(int room_id, int fd, std::string hello, FrameReader in);
+    size_t load() const { return load_; }
+
+    // Used by matches (on this worker's thread) to route socket events to themselves.
+    void watch(int fd, Match *m, uint32_t events);
+    void unwatch(int fd);
+    void schedule(Match *m);
+
+private:
+    struct Arrival {
+        int room_id, fd;
+        std::string hello;
+        FrameReader in;
+    };
+
+    void run(int cpu);
+    void take_inbox();
+    void run_due();
+    void rearm();
+
+    MatchScheduler &sched_;
+    int index_;
+    int epfd_ = -1, timerfd_ = -1, wakefd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> load_{0};
+    std::mutex inbox_mu_;
+    std::vector<std::unique_ptr<Match>> inbox_;
+    std::vector<Arrival> arrivals_;
+
+    uint64_t next_id_ = 1;
+    std::unordered_map<uint64_t, std::unique_ptr<Match>> matches_;
+    std::unordered_map<int, Match *> owners_; // fd -> match
+    std::unordered_map<int, uint64_t> rooms_; // room id -> match id
+    using Due = std::pair<Clock::time_point, uint64_t>; // stale entries are skipped when popped
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> due_;
+    std::thread thread_;
+};
+
+// Fixed pool of MatchWorkers, one per core; new matches go to the least loaded worker.
+// All gameplay connections arrive on one shared port; the lobby thread reads their
+// handshake and route() passes them to the worker running that room's match.
+class MatchScheduler {
+public:
+    MatchScheduler(DataClient &dc, int workers = 0);
+
+    // False if a match for this room is already running; nothing is started then.
+    bool launch(json room, json pA, json pB);
+    // False if no match is running for `room_id` (the caller still owns `fd` then).
+    bool route(int room_id, int fd, std::string hello, FrameReader in);
+    // Called by a worker once its match for `room_id` is gone.
+    void forget(int room_id, MatchWorker *w);
+
+private:
+    DataClient &dc_;
+    std::vector<std::unique_ptr<MatchWorker>> workers_;
+    std::mutex rooms_mu_;
+    std::unordered_map<int, MatchWorker *> rooms_; // room id -> worker running its match
+};
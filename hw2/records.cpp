@@ -0,0 +1,101 @@
+#include "records.h"
+
+using namespace std;
+
+static const char *USER_STATUS[] = {"idle", "offline", "room", "playing", "spectating"};
+static const char *ROOM_STATUS[] = {"idle", "playing"};
+static const char *VISIBILITY[] = {"public", "private"};
+
+// Index of `s` in `names`, or `fallback` for anything else.
+template <size_t N>
+static uint8_t intern(const string &s, const char *(&names)[N], uint8_t fallback) {
+    for (size_t i = 0; i < N; ++i)
+        if (s == names[i]) return static_cast<uint8_t>(i);
+    return fallback;
+}
+
+template <size_t N>
+static void read_ids(SmallIds<N> &ids, const json &arr) {
+    ids.clear();
+    if (!arr.is_array()) return;
+    for (auto &x : arr)
+        if (x.is_number_integer()) ids.push_back(x.get<int>());
+}
+
+template <size_t N>
+static json ids_json(const SmallIds<N> &ids) {
+    json arr = json::array();
+    for (int x : ids) arr.push_back(x);
+    return arr;
+}
+
+void apply_json(User &u, const json &data) {
+    for (auto &[k, v] : data.items()) {
+        if (k == "name") u.name = v.get<string>();
+        else if (k == "password") u.password = v.get<string>();
+        else if (k == "last_login") u.last_login = v.get<string>();
+        else if (k == "status") u.status = static_cast<User::Status>(intern(v.get<string>(), USER_STATUS, User::Idle));
+        else if (k == "roomName") u.roomName = v.get<string>();
+    }
+}
+
+void apply_json(Room &r, const json &data) {
+    for (auto &[k, v] : data.items()) {
+        if (k == "name") r.name = v.get<string>();
+        else if (k == "hostUser") r.hostUser = v.get<string>();
+        else if (k == "oppoUser") r.oppoUser = v.get<string>();
+        else if (k == "visibility") r.visibility = static_cast<Room::Visibility>(intern(v.get<string>(), VISIBILITY, Room::Public));
+        else if (k == "status") r.status = static_cast<Room::Status>(intern(v.get<string>(), ROOM_STATUS, Room::Idle));
+        else if (k == "inviteList") read_ids(r.inviteList, v);
+        else if (k == "specList") read_ids(r.specList, v);
+        else if (k == "difficulty") r.difficulty = static_cast<uint8_t>(min(10, max(2, v.get<int>())));
+        else if (k == "tickRate") r.tickRate = static_cast<uint8_t>(min(60, max(5, v.get<int>())));
+    }
+}
+
+json to_json(const User &u) {
+    return {
+        {"id", u.id},
+        {"name", u.name},
+        {"password", u.password},
+        {"last_login", u.last_login},
+        {"status", USER_STATUS[u.status]},
+        {"roomName", u.roomName}
+    };
+}
+
+json to_json(const Room &r) {
+    return {
+        {"id", r.id},
+        {"name", r.name},
+        {"hostUser", r.hostUser},
+        {"oppoUser", r.oppoUser},
+        {"visibility", VISIBILITY[r.visibility]},
+        {"inviteList", ids_json(r.inviteList)},
+        {"specList", ids_json(r.specList)},
+        {"status", ROOM_STATUS[r.status]},
+        {"difficulty", r.difficulty},
+        {"tickRate", r.tickRate}
+    };
+}
+
+bool parse_enum(const string &s, User::Status &out) {
+    uint8_t v = intern(s, USER_STATUS, 0xFF);
+    if (v == 0xFF) return false;
+    out = static_cast<User::Status>(v);
+    return true;
+}
+
+bool parse_enum(const string &s, Room::Status &out) {
+    uint8_t v = intern(s, ROOM_STATUS, 0xFF);
+    if (v == 0xFF) return false;
+    out = static_cast<Room::Status>(v);
+    return true;
+}
+
+bool parse_enum(const string &s, Room::Visibility &out) {
+    uint8_t v = intern(s, VISIBILITY, 0xFF);
+    if (v == 0xFF) return false;
+    out = static_cast<Room::Visibility>(v);
+    return true;
+}
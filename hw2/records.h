@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// Typed user/room records kept by the data server. Statuses are small enums and the
+// invite/spectator lists keep their first few ids inline; JSON is only built at the wire.
+
+// Id list that stores up to N ids inline and only spills to the heap beyond that.
+template <size_t N>
+class SmallIds {
+public:
+    const int *begin() const { return heap_.empty() ? inline_ : heap_.data(); }
+    const int *end() const { return begin() + size_; }
+    size_t size() const { return size_; }
+    bool contains(int id) const {
+        for (int x : *this) if (x == id) return true;
+        return false;
+    }
+    void push_back(int id) {
+        if (size_ < N) inline_[size_] = id;
+        else {
+            if (heap_.empty()) heap_.assign(inline_, inline_ + N);
+            heap_.push_back(id);
+        }
+        ++size_;
+    }
+    void clear() {
+        size_ = 0;
+        heap_.clear();
+        heap_.shrink_to_fit();
+    }
+
+private:
+    uint32_t size_ = 0;
+    int inline_[N] = {};
+    std::vector<int> heap_; // all ids once there are more than N
+};
+
+struct User {
+    enum Status : uint8_t { Idle, Offline, InRoom, Playing, Spectating };
+
+    int id = -1;
+    Status status = Idle;
+    std::string name, password, last_login;
+    std::string roomName = "-1"; // "-1" when not in a room
+};
+
+struct Room {
+    enum Status : uint8_t { Idle, Playing };
+    enum Visibility : uint8_t { Public, Private };
+
+    int id = -1;
+    Status status = Idle;
+    Visibility visibility = Public;
+    uint8_t difficulty = 10; // clamped to [2, 10]
+    uint8_t tickRate = 10;   // match ticks per second, clamped to [5, 60]
+    std::string name, hostUser, oppoUser;
+    SmallIds<4> inviteList, specList;
+};
+
+// Overwrite the fields present in `data` (the "id" field is ignored); throws on mistyped fields.
+void apply_json(User &u, const json &data);
+void apply_json(Room &r, const json &data);
+
+json to_json(const User &u);
+json to_json(const Room &r);
+
+// The value named `s` (as to_json() writes it); false for a name that is not one of them.
+bool parse_enum(const std::string &s, User::Status &out);
+bool parse_enum(const std::string &s, Room::Status &out);
+bool parse_enum(const std::string &s, Room::Visibility &out);
@@ -0,0 +1,55 @@
+#include "replay.h"
+
+using namespace std;
+
+Tetris::Action parse_action(const string &name) {
+    using A = Tetris::Action;
+    if (name == "Left") return A::Left;
+    if (name == "Right") return A::Right;
+    if (name == "SoftDrop") return A::SoftDrop;
+    if (name == "HardDrop") return A::HardDrop;
+    if (name == "RotateCW") return A::RotateCW;
+    if (name == "RotateCCW") return A::RotateCCW;
+    if (name == "Hold") return A::Hold;
+    return A::None;
+}
+
+json Replay::to_json() const {
+    return {
+        {"v", VERSION},
+        {"seed", seed},
+        {"difficulty", difficulty},
+        {"tickRate", tick_rate},
+        {"frames", frames},
+        {"host", inputs[0]},
+        {"oppo", inputs[1]}
+    };
+}
+
+bool Replay::from_json(const json &j, Replay &out) {
+    if (!j.is_object() || j.value("v", 0) != VERSION) return false;
+    try {
+        out.seed = j.at("seed").get<uint32_t>();
+        out.difficulty = j.at("difficulty").get<int>();
+        out.tick_rate = j.value("tickRate", 10);
+        out.frames = j.at("frames").get<int>();
+        out.inputs[0] = j.at("host").get<vector<uint32_t>>();
+        out.inputs[1] = j.at("oppo").get<vector<uint32_t>>();
+    } catch (const exception &) {
+        return false;
+    }
+    return true;
+}
+
+void Replay::play(Tetris &host, Tetris &oppo) const {
+    Tetris *games[2] = {&host, &oppo};
+    size_t next[2] = {0, 0};
+    for (int f = 1; f <= frames; ++f) {
+        for (int p = 0; p < 2; ++p) {
+            const auto &in = inputs[p];
+            for (; next[p] < in.size() && (int)(in[next[p]] >> 3) == f; ++next[p])
+                games[p]->step(static_cast<Tetris::Action>(in[next[p]] & 7));
+            games[p]->step(Tetris::Action::None);
+        }
+    }
+}
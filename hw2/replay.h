@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "tetris.h"
+
+using json = nlohmann::json;
+
+// Everything needed to re-simulate a match. The engine is deterministic given the seed,
+// the drop interval and the frame each action was applied on, so a replay is a few KB
+// where the snapshot stream of the same match is megabytes.
+struct Replay {
+    static const int VERSION = 1;
+
+    uint32_t seed = 0;
+    int difficulty = 10;
+    int tick_rate = 10; // ticks per second, older replays without it ran at 10
+    int frames = 0;     // ticks the match ran
+    // Per player (host, opponent), in the order applied: frame << 3 | action
+    std::array<std::vector<uint32_t>, 2> inputs;
+
+    void record(int player, int frame, Tetris::Action a) {
+        inputs[player].push_back(static_cast<uint32_t>(frame) << 3 | static_cast<uint32_t>(a));
+    }
+
+    json to_json() const;
+    static bool from_json(const json &j, Replay &out);
+
+    // Re-run all `frames` ticks on engines freshly built from (seed, difficulty, tick_rate), applying
+    // each frame's inputs before its step(None): Match applies them as they arrive and
+    // stamps them with the tick that follows, which gives the same sequence of steps.
+    void play(Tetris &host, Tetris &oppo) const;
+};
+
+// Gameplay action names ("Left", "HardDrop", ...); Action::None for anything else.
+Tetris::Action parse_action(const std::string &name);
@@ -0,0 +1,53 @@
+// Re-simulates saved matches from their replays and checks the recorded results.
+// usage: ./replay_player.out [gamelog.json] [line]   (default data/gamelog.json, every line)
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "replay.h"
+#include "tetris.h"
+
+using namespace std;
+
+int main(int argc, char **argv) {
+    string path = argc > 1 ? argv[1] : "data/gamelog.json";
+    int only = argc > 2 ? stoi(argv[2]) : -1;
+    ifstream in(path);
+    if (!in.is_open()) {
+        cerr << "[Replay] Cannot open " << path << endl;
+        return 2;
+    }
+
+    int lineno = 0, checked = 0, mismatched = 0;
+    string line;
+    while (getline(in, line)) {
+        ++lineno;
+        if (line.empty() || (only >= 0 && lineno != only)) continue;
+        json log = json::parse(line, nullptr, false);
+        Replay r;
+        if (log.is_discarded() || !Replay::from_json(log.value("replay", json()), r)) {
+            cout << "[Replay] #" << lineno << " has no replay, skipped" << endl;
+            continue;
+        }
+
+        auto t0 = chrono::steady_clock::now();
+        Tetris host(r.seed, r.difficulty, r.tick_rate), oppo(r.seed, r.difficulty, r.tick_rate);
+        r.play(host, oppo);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+
+        bool ok = host.result_json() == log.value("host_result", json()) &&
+                  oppo.result_json() == log.value("oppo_result", json());
+        ++checked;
+        if (!ok) ++mismatched;
+        cout << "[Replay] #" << lineno << " " << log.value("hostUser", "?") << " vs " << log.value("oppoUser", "?")
+             << ": " << r.frames << " frames in " << ms << " ms ("
+             << (ms > 0 ? r.frames * 1000.0 / r.tick_rate / ms : 0) << "x real time) - "
+             << (ok ? "results match" : "RESULTS DIFFER") << endl;
+        if (!ok) {
+            cout << "  recorded host " << log.value("host_result", json()).dump() << " oppo " << log.value("oppo_result", json()).dump() << endl;
+            cout << "  replayed host " << host.result_json().dump() << " oppo " << oppo.result_json().dump() << endl;
+        }
+    }
+    cout << "[Replay] " << checked << " replay(s) checked, " << mismatched << " mismatch(es)" << endl;
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+#include "session.h"
+#include <algorithm>
+
+SessionCache sessions;
+
+void SessionCache::add(const json &user, const json &reply) {
+    users_[user["id"].get<int>()] = {user, 0, reply.value("seq", uint64_t{0})};
+}
+
+const json *SessionCache::find(int uid) const {
+    auto it = users_.find(uid);
+    return it == users_.end() ? nullptr : &it->second.user;
+}
+
+json SessionCache::update(int uid, const json &fields) {
+    auto it = users_.find(uid);
+    if (it != users_.end()) {
+        it->second.user.update(fields);
+        ++it->second.pending;
+    }
+    json data = fields;
+    data["id"] = uid;
+    return {{"action", "update"}, {"type", "user"}, {"data", data}};
+}
+
+void SessionCache::settled(int uid, const json &reply) {
+    auto it = users_.find(uid);
+    if (it == users_.end() || it->second.pending == 0) return; // logged out and back in since
+    --it->second.pending;
+    it->second.seq = std::max(it->second.seq, reply.value("seq", uint64_t{0}));
+}
+
+void SessionCache::refresh(const json &user, uint64_t seq) {
+    auto it = users_.find(user.value("id", -1));
+    if (it == users_.end() || it->second.pending > 0 || seq <= it->second.seq) return;
+    it->second.seq = seq;
+    for (const char *k : {"status", "roomName"})
+        if (user.contains(k)) it->second.user[k] = user[k];
+}
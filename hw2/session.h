@@ -0,0 +1,39 @@
+#pragma once
+#include <unordered_map>
+#include "nlohmann/json.hpp"
+
+using json = nlohmann::json;
+
+// The game server's copy of each logged-in user's record, so a lobby request does not
+// start with a data server round trip to fetch its caller. Writes made here go through
+// update(), which patches the copy as it builds the request. Other game servers sharing
+// the data server can write the same record (a match cleanup there resets its players),
+// so the data server's "user" change events are folded in with refresh() as well. An
+// event can predate a write made here, so refresh() ignores events while a write to the
+// user is unanswered and those no newer than the "seq" of the last reply settled().
+// Lobby thread only (match cleanup reaches it from a data server callback, which the
+// DataClient always runs on the lobby thread).
+class SessionCache {
+public:
+    // `reply` is the data server reply `user` was read from or written with.
+    void add(const json &user, const json &reply);
+    void remove(int uid) { users_.erase(uid); }
+    // nullptr when `uid` is not logged in here
+    const json *find(int uid) const;
+    // Patch the cached record (if any) and return the update request carrying just `fields`;
+    // its reply must be passed to settled().
+    json update(int uid, const json &fields);
+    void settled(int uid, const json &reply);
+    // Take the status and room of a "user" change event for a user logged in here.
+    void refresh(const json &user, uint64_t seq);
+
+private:
+    struct Entry {
+        json user;
+        int pending = 0;  // update()s not yet settled()
+        uint64_t seq = 0; // events up to this one are already reflected in `user`
+    };
+    std::unordered_map<int, Entry> users_;
+};
+
+extern SessionCache sessions;
@@ -0,0 +1,125 @@
+#include "snapshot.h"
+#include <arpa/inet.h>
+#include <cstring>
+
+using namespace std;
+
+bool SnapshotStream::parse_format(const string &name, Format &out) {
+    if (name == "full") out = Full;
+    else if (name == "delta") out = Delta;
+    else if (name == "binary") out = Binary;
+    else return false;
+    return true;
+}
+
+SnapshotStream::View SnapshotStream::view_of(const Tetris &t) {
+    const auto &s = t.state();
+    View v;
+    v.cells = t.board();
+    v.pose = {s.active.id, s.active.x, s.active.y, s.active.rot, s.ghostY};
+    v.hold = s.hold;
+    v.score = s.score;
+    v.lines = s.lines;
+    v.level = s.level;
+    v.over = s.gameOver;
+    return v;
+}
+
+void SnapshotStream::capture(int f, const vector<pair<string, const Tetris *>> &games, const vector<uint32_t> &seqs) {
+    prev_frame_ = frame_;
+    frame_ = f;
+    games_ = games;
+    prev_.swap(cur_);
+    cur_.clear();
+    for (size_t i = 0; i < games_.size(); ++i) {
+        cur_.push_back(view_of(*games_[i].second));
+        cur_.back().seq = i < seqs.size() ? seqs[i] : 0;
+    }
+    if (prev_.size() != cur_.size()) prev_.clear();
+    full_.reset();
+    key_.reset();
+    delta_.reset();
+    bin_.reset();
+}
+
+const SnapshotStream::Frame &SnapshotStream::full() {
+    if (full_) return full_;
+    // Send game states with usernames as keys
+    json state = {{"f", frame_}};
+    for (size_t i = 0; i < games_.size(); ++i) {
+        json g = games_[i].second->to_json();
+        g["q"] = cur_[i].seq;
+        state[games_[i].first] = std::move(g);
+    }
+    return full_ = FrameWriter::frame(state.dump());
+}
+
+const SnapshotStream::Frame &SnapshotStream::binary() {
+    if (bin_) return bin_;
+    if (!bin_buf_ || bin_buf_.use_count() > 1) bin_buf_ = make_shared<string>(); // last one is still queued somewhere
+    const size_t per_game = Tetris::kBinarySize + 4;
+    uint32_t len = 5 + games_.size() * per_game;
+    bin_buf_->resize(4 + len);
+    uint8_t *p = reinterpret_cast<uint8_t *>(&(*bin_buf_)[0]);
+    uint32_t net_len = htonl(len);
+    memcpy(p, &net_len, 4);
+    p += 4;
+    p[0] = BINARY_VERSION;
+    for (int i = 0; i < 4; ++i) p[1 + i] = static_cast<uint8_t>(static_cast<uint32_t>(frame_) >> (24 - 8 * i));
+    p += 5;
+    for (size_t i = 0; i < games_.size(); ++i) {
+        games_[i].second->write_binary(p);
+        p += Tetris::kBinarySize;
+        uint32_t seq = htonl(cur_[i].seq);
+        memcpy(p, &seq, 4);
+        p += 4;
+    }
+    return bin_ = bin_buf_;
+}
+
+const SnapshotStream::Frame &SnapshotStream::keyframe() {
+    if (key_) return key_;
+    json state = {{"f", frame_}, {"k", 1}};
+    for (size_t i = 0; i < cur_.size(); ++i) {
+        const View &v = cur_[i];
+        state[games_[i].first] = {
+            {"b", v.cells}, // locked cells, the active piece and ghost are drawn from "p"
+            {"p", v.pose},
+            {"h", v.hold},
+            {"s", v.score},
+            {"l", v.lines},
+            {"v", v.level},
+            {"g", v.over},
+            {"q", v.seq}
+        };
+    }
+    return key_ = FrameWriter::frame(state.dump());
+}
+
+const SnapshotStream::Frame &SnapshotStream::delta() {
+    if (delta_) return delta_;
+    if (prev_.empty()) return keyframe(); // nothing to diff against yet
+
+    json state = {{"f", frame_}};
+    for (size_t i = 0; i < cur_.size(); ++i) state[games_[i].first] = diff(prev_[i], cur_[i]);
+    return delta_ = FrameWriter::frame(state.dump());
+}
+
+json SnapshotStream::diff(const View &p, const View &v) {
+    json d = json::object();
+    vector<int> changed; // flat (index, value) pairs
+    for (size_t c = 0; c < v.cells.size(); ++c) {
+        if (v.cells[c] == p.cells[c]) continue;
+        changed.push_back(static_cast<int>(c));
+        changed.push_back(v.cells[c]);
+    }
+    if (!changed.empty()) d["c"] = changed;
+    if (v.pose != p.pose) d["p"] = v.pose;
+    if (v.hold != p.hold) d["h"] = v.hold;
+    if (v.score != p.score) d["s"] = v.score;
+    if (v.lines != p.lines) d["l"] = v.lines;
+    if (v.level != p.level) d["v"] = v.level;
+    if (v.over != p.over) d["g"] = v.over;
+    if (v.seq != p.seq) d["q"] = v.seq;
+    return d;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "tetris.h"
+#include "utility.h"
+
+// Encodes one match's per-tick state snapshots in every format a client can ask for.
+// "full" sends both composite boards each frame (Tetris::to_json()). "delta" sends a
+// keyframe, then per frame only the locked cells that changed, the active piece pose
+// and hold/score/lines/level/gameOver when they change. "binary" packs the same
+// content as "full" into a fixed-size frame (Tetris::write_binary()). Every format also
+// carries, per game, the seq of the last player input applied to it ("q"), which a
+// client reconciles its predicted inputs against. Each format is
+// encoded and framed at most once per frame and only if some connection wants it;
+// every connection's FrameWriter then queues a reference to that same buffer.
+class SnapshotStream {
+public:
+    enum Format { Full, Delta, Binary };
+    static const uint8_t BINARY_VERSION = 2;
+
+    static bool parse_format(const std::string &name, Format &out);
+
+    // Record frame `f`; the engines are read again by full() and binary() until the next capture.
+    // `seqs` holds each game's last applied input seq, in the order of `games`.
+    void capture(int f, const std::vector<std::pair<std::string, const Tetris *>> &games, const std::vector<uint32_t> &seqs);
+
+    using Frame = FrameWriter::Frame;
+    const Frame &full();
+    // Version byte, frame u32 (big-endian), then per game in capture order Tetris::kBinarySize
+    // bytes and its input seq u32.
+    const Frame &binary();
+    const Frame &keyframe();
+    // Changes since the previous capture. Only valid for a connection that received the
+    // previous frame; one that missed it (or has none yet) needs keyframe() instead.
+    const Frame &delta();
+    // A forced keyframe each time a multiple of this many frames is reached or passed.
+    int keyframe_interval = 50;
+    bool keyframe_due() const { return frame_ / keyframe_interval != prev_frame_ / keyframe_interval; }
+
+    // What a delta is computed from: one engine's drawable state.
+    struct View {
+        std::array<uint8_t, Tetris::kWidth * Tetris::kHeight> cells; // locked cells only
+        std::array<int, 5> pose;                                     // piece, x, y, rot, ghostY
+        int hold, score, lines, level;
+        bool over;
+        uint32_t seq = 0; // last applied input, set by capture()
+    };
+    static View view_of(const Tetris &t);
+    // One game's entry of a delta frame: the fields of `cur` that differ from `prev`.
+    static json diff(const View &prev, const View &cur);
+
+private:
+
+    int frame_ = 0, prev_frame_ = 0; // of this capture and the one before
+    std::vector<std::pair<std::string, const Tetris *>> games_;
+    std::vector<View> cur_, prev_; // prev_ is empty before the second capture
+    Frame full_, key_, delta_, bin_; // null until encoded for the current frame
+    std::shared_ptr<std::string> bin_buf_; // rewritten in place once no queue holds it
+};
@@ -22,7 +22,7 @@ json Tetris::result_json() const {
     };
 }
 
-static inline void rotXY(int &x, int &y, int rot) {
+static constexpr void rotXY(int &x, int &y, int rot) {
     int nx = x, ny = y;
     switch (rot & 3) {
         case 0: break;
@@ -33,18 +33,36 @@ static inline void rotXY(int &x, int &y, int rot) {
     x = nx; y = ny;
 }
 
+// Row masks of every piece and rotation: bit dx of MASKS.m[p][rot][dy] is set when the
+// 4x4 box cell (dx, dy) is filled, so a piece at x covers (mask << (x + kWallBits)) of a row.
+struct PieceMasks { uint16_t m[8][4][4]; };
+
+static constexpr PieceMasks buildMasks() {
+    PieceMasks t{};
+    for (int p = 1; p < 8; ++p)
+        for (int rot = 0; rot < 4; ++rot)
+            for (int dy = 0; dy < 4; ++dy)
+                for (int dx = 0; dx < 4; ++dx) {
+                    int x = dx, y = dy;
+                    rotXY(x, y, rot);
+                    if (SHAPES[p][y][x]) t.m[p][rot][dy] |= static_cast<uint16_t>(1u << dx);
+                }
+    return t;
+}
+
+static constexpr PieceMasks MASKS = buildMasks();
+
 bool Tetris::cell(Piece p, int rot, int dx, int dy) {
-    if (p == Empty) return false;
     if (dx < 0 || dx >= 4 || dy < 0 || dy >= 4) return false;
-    int x = dx, y = dy;
-    rotXY(x, y, rot);
-    return SHAPES[p][y][x] != 0;
+    return (MASKS.m[p][rot & 3][dy] >> dx) & 1;
 }
 
-Tetris::Tetris(uint32_t seed, int dropInterval) : rng_(seed), dropInterval_(dropInterval) { reset(); }
+Tetris::Tetris(uint32_t seed, int dropInterval, int tickRate)
+    : rng_(seed), dropInterval_(dropInterval), tickRate_(tickRate) { reset(); }
 
 void Tetris::reset() {
     board_.fill(0);
+    rows_.fill(kEmptyRow);
     bag_.clear();
     st_ = {};
     st_.level = 1;
@@ -70,11 +88,17 @@ Tetris::Piece Tetris::popNext() {
 }
 
 bool Tetris::canPlace(const Active& a) const {
-    for (int py=0; py<4; ++py) for (int px=0; px<4; ++px) {
-        if (!cell(a.id,a.rot,px,py)) continue;
-        int bx=a.x+px, by=a.y+py;
-        if (bx<0||bx>=kWidth||by>=kHeight) return false;
-        if (by>=0 && board_[idx(bx,by)]!=0) return false;
+    const uint16_t *m = MASKS.m[a.id][a.rot & 3];
+    int shift = a.x + kWallBits;
+    if (shift < 0 || shift > 16 - kWallBits) return a.id == Empty; // every cell would be past a wall
+    for (int py=0; py<4; ++py) {
+        if (!m[py]) continue;
+        uint32_t piece = static_cast<uint32_t>(m[py]) << shift;
+        int by = a.y + py;
+        if (by >= kHeight) return false;
+        // rows above the board only have walls; bits past 15 are the right wall too
+        uint32_t row = 0xFFFF0000u | (by >= 0 ? rows_[by] : kEmptyRow);
+        if (piece & row) return false;
     }
     return true;
 }
@@ -104,8 +128,10 @@ void Tetris::lockPiece(){
     for(int py=0;py<4;++py)for(int px=0;px<4;++px){
         if(!cell(a.id,a.rot,px,py))continue;
         int bx=a.x+px,by=a.y+py;
-        if(by>=0&&by<kHeight&&bx>=0&&bx<kWidth)
+        if(by>=0&&by<kHeight&&bx>=0&&bx<kWidth){
             board_[idx(bx,by)]=static_cast<uint8_t>(a.id);
+            rows_[by]|=static_cast<uint16_t>(1u<<(bx+kWallBits));
+        }
     }
     clearLinesAndScore();
     spawn();
@@ -113,18 +139,19 @@ void Tetris::lockPiece(){
 }
 
 int Tetris::clearLinesAndScore(){
-    int cleared=0;
+    // compact the rows that are not full towards the bottom, then clear what is left on top
+    int cleared=0, dst=kHeight-1;
     for(int y=kHeight-1;y>=0;--y){
-        bool full=true;
-        for(int x=0;x<kWidth;++x) if(board_[idx(x,y)]==0){full=false;break;}
-        if(full){
-            ++cleared;
-            for(int yy=y;yy>0;--yy)
-                for(int x=0;x<kWidth;++x)
-                    board_[idx(x,yy)]=board_[idx(x,yy-1)];
-            for(int x=0;x<kWidth;++x) board_[idx(x,0)]=0;
-            ++y;
+        if(rows_[y]==kFullRow){ ++cleared; continue; }
+        if(dst!=y){
+            rows_[dst]=rows_[y];
+            std::copy_n(&board_[idx(0,y)],kWidth,&board_[idx(0,dst)]);
         }
+        --dst;
+    }
+    for(int y=dst;y>=0;--y){
+        rows_[y]=kEmptyRow;
+        std::fill_n(&board_[idx(0,y)],kWidth,uint8_t{0});
     }
     int add=0;
     switch(cleared){
@@ -164,13 +191,13 @@ bool Tetris::step(Action a){
             if(move(0,1)){
                 ++sdrop;
                 changed=true;
-                st_.framesSinceLastDrop=0; // Reset frame counter on soft drop
+                st_.dropTimer=0; // Reset gravity on soft drop
             }
             break;
         case Action::HardDrop:
             while(move(0,1))++hdrop;
             lockPiece();
-            st_.framesSinceLastDrop=0; // Reset frame counter on hard drop
+            st_.dropTimer=0; // Reset gravity on hard drop
             changed=true;
             break;
         case Action::RotateCW:{Active t=st_.active;if(testKick(t,1)){st_.active=t;changed=true;}}break;
@@ -184,17 +211,17 @@ bool Tetris::step(Action a){
                     if(!canPlace(st_.active)){st_.active.y=0;}
                     if(!canPlace(st_.active))st_.gameOver=true;
                 }
-                st_.framesSinceLastDrop=0; // Reset frame counter on hold
+                st_.dropTimer=0; // Reset gravity on hold
                 changed=true;
             }
             break;
         default:break;
     }
 
-    // Auto-drop logic: only drop if dropInterval_ frames have passed and not hard dropping
+    // Auto-drop logic: only drop if dropInterval_ tenths of a second have passed and not hard dropping
     if(a!=Action::HardDrop){
-        ++st_.framesSinceLastDrop;
-        if(st_.framesSinceLastDrop>=dropInterval_){
+        st_.dropTimer+=10;
+        if(st_.dropTimer>=dropInterval_*tickRate_){
             Active t=st_.active;t.y++;
             if(canPlace(t)){
                 st_.active=t;
@@ -204,7 +231,7 @@ bool Tetris::step(Action a){
                 lockPiece();
                 changed=true;
             }
-            st_.framesSinceLastDrop=0; // Reset after auto-drop
+            st_.dropTimer-=dropInterval_*tickRate_; // keep the remainder when a drop falls between ticks
         }
     }
 
@@ -242,11 +269,8 @@ std::string Tetris::debugString() const {
 }
 
 // --- JSON serialization ---
-json Tetris::to_json() const {
-    json j;
-    // Create a composite board with ghost and active pieces included
-    std::array<uint8_t, kWidth * kHeight> compositeBoard;
-
+// Board with ghost (8) and active (9) pieces drawn in, as sent to clients.
+void Tetris::composeBoard(std::array<uint8_t, kWidth * kHeight>& compositeBoard) const {
     // Copy the base board
     for (int y=0; y<kHeight; ++y)
         for (int x=0; x<kWidth; ++x)
@@ -283,6 +307,14 @@ json Tetris::to_json() const {
             }
         }
     }
+}
+
+json Tetris::to_json() const {
+    json j;
+    // Create a composite board with ghost and active pieces included
+    std::array<uint8_t, kWidth * kHeight> compositeBoard;
+    composeBoard(compositeBoard);
+    const auto& s = st_;
 
     // Convert board to simple array
     std::vector<int> boardArray;
@@ -302,3 +334,21 @@ json Tetris::to_json() const {
     };
     return j;
 }
+
+// --- Binary serialization ---
+static inline uint8_t *putBE(uint8_t *p, uint32_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) *p++ = static_cast<uint8_t>(v >> (8 * i));
+    return p;
+}
+
+void Tetris::write_binary(uint8_t *out) const {
+    std::array<uint8_t, kWidth * kHeight> compositeBoard;
+    composeBoard(compositeBoard);
+    for (size_t i = 0; i < compositeBoard.size(); i += 2)
+        *out++ = static_cast<uint8_t>(compositeBoard[i] << 4 | compositeBoard[i + 1]);
+    out = putBE(out, st_.hold, 1);
+    out = putBE(out, static_cast<uint32_t>(st_.score), 4);
+    out = putBE(out, static_cast<uint32_t>(st_.lines), 4);
+    out = putBE(out, static_cast<uint32_t>(st_.level), 2);
+    putBE(out, st_.gameOver, 1);
+}
@@ -37,10 +37,11 @@ public:
         bool holdLocked = false;
         std::array<Piece, 6> nextPreview{};
         int ghostY = 0;
-        int framesSinceLastDrop = 0;
+        int dropTimer = 0; // gravity clock, see dropInterval_
     };
 
-    explicit Tetris(uint32_t seed = std::random_device{}(), int dropInterval = 10);
+    // dropInterval: tenths of a second between auto-drops; tickRate: step() calls per second.
+    explicit Tetris(uint32_t seed = std::random_device{}(), int dropInterval = 10, int tickRate = 10);
     void reset();
     bool step(Action a);
 
@@ -51,13 +52,30 @@ public:
     json result_json() const;
     // --- serialization ---
     json to_json() const;
+    // Packed binary state: 100 bytes of 4-bit cells (same values as to_json's "b", even cell in
+    // the high nibble), hold u8, score u32, lines u32, level u16, gameOver u8, all big-endian.
+    static constexpr size_t kBinarySize = kWidth * kHeight / 2 + 12;
+    void write_binary(uint8_t *out) const; // writes exactly kBinarySize bytes, no allocation
 
 private:
-    std::array<uint8_t, kWidth * kHeight> board_{};
+    friend struct TetrisBench; // bench.cpp times the private hot paths directly
+
+    // Bitboard: one mask per row, cell x at bit x + kWallBits. The bits on either side are
+    // permanently set as walls, so collision is a shift and an AND and a full row is 0xFFFF.
+    static constexpr int kWallBits = 3;
+    static constexpr uint16_t kEmptyRow = 0xE007;
+    static constexpr uint16_t kFullRow = 0xFFFF;
+
+    std::array<uint8_t, kWidth * kHeight> board_{}; // piece id per cell, kept for drawing
+    std::array<uint16_t, kHeight> rows_{};
     std::mt19937 rng_;
     std::vector<Piece> bag_;
     State st_{};
-    int dropInterval_; // Frames between auto-drops (lower = harder)
+    // Gravity is timed, not counted in frames: every step() advances dropTimer by 10 and a
+    // drop is due at dropInterval_ * tickRate_, i.e. after dropInterval_ tenths of a second
+    // at any tick rate (lower = harder). At 10 ticks/s that is one frame per tenth.
+    int dropInterval_;
+    int tickRate_;
 
     void spawn();
     bool canPlace(const Active& a) const;
@@ -66,6 +84,7 @@ private:
     void newBagIfNeeded();
     Piece popNext();
     void computeGhost();
+    void composeBoard(std::array<uint8_t, kWidth * kHeight>& out) const;
     bool testKick(Active& a, int rotDir) const;
     void addLockScore(int cleared, int softDropCells, int hardDropCells);
 
@@ -1,4 +1,8 @@
+#include "utility.h"
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <cstring>
 #include <unistd.h>
 #include <string>
 #include <vector>
@@ -6,6 +10,8 @@
 #include <sstream>
 #include <iomanip>
 #include <cerrno>
+#include <fcntl.h>
+#include <netinet/tcp.h>
 
 bool send_message(int sock, const std::string &msg) {
     unsigned len = msg.size();
@@ -65,7 +71,7 @@ std::string recv_message(int sock) {
     unsigned len = ntohl(net_len);
 
     // Check if length is valid
-    if (len == 0 || len > 65536) {
+    if (len == 0 || len > MAX_FRAME_LEN) {
         return std::string(); // invalid length
     }
 
@@ -95,4 +101,153 @@ std::string now_time_str() {
     std::ostringstream oss;
     oss << std::put_time(&tm, "%Y-%m-%d %H:%M:%S");
     return oss.str();
-}
\ No newline at end of file
+}
+
+int make_socket_non_blocking(int s){int f=fcntl(s,F_GETFL,0);return fcntl(s,F_SETFL,f|O_NONBLOCK);}
+
+int set_no_delay(int s){int one=1;return setsockopt(s,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));}
+
+bool write_fully(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+FrameReader::Status FrameReader::fill(int sock) {
+    char chunk[64 * 1024];
+    while (true) {
+        // MSG_DONTWAIT so this also works on sockets left in blocking mode
+        ssize_t n = recv(sock, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if (n > 0) {
+            if (pos_ > 0 && pos_ == buf_.size()) {
+                buf_.clear();
+                pos_ = 0;
+            }
+            buf_.append(chunk, n);
+            continue;
+        }
+        if (n == 0) return Closed;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return Open;
+        return Error;
+    }
+}
+
+bool FrameReader::next(std::string &out) {
+    if (corrupt_ || buf_.size() - pos_ < sizeof(uint32_t)) return false;
+
+    uint32_t net_len;
+    memcpy(&net_len, buf_.data() + pos_, sizeof(net_len));
+    unsigned len = ntohl(net_len);
+    if (len == 0 || len > MAX_FRAME_LEN) {
+        corrupt_ = true;
+        return false;
+    }
+    if (buf_.size() - pos_ - sizeof(net_len) < len) return false; // body not complete yet
+
+    out.assign(buf_, pos_ + sizeof(net_len), len);
+    pos_ += sizeof(net_len) + len;
+    if (pos_ == buf_.size()) {
+        buf_.clear();
+        pos_ = 0;
+    } else if (pos_ > buf_.size() / 2) {
+        // drop consumed bytes once they dominate the buffer
+        buf_.erase(0, pos_);
+        pos_ = 0;
+    }
+    return true;
+}
+
+FrameWriter::Frame FrameWriter::frame(const std::string &msg) {
+    uint32_t net_len = htonl(msg.size());
+    auto f = std::make_shared<std::string>();
+    f->reserve(sizeof(net_len) + msg.size());
+    f->append((const char *)&net_len, sizeof(net_len));
+    f->append(msg);
+    return f;
+}
+
+FrameWriter::Result FrameWriter::send(int sock, const Frame &f, bool droppable) {
+    if (failed_) return Failed;
+    if (droppable && queued_ >= high_water_) {
+        ++dropped_;
+        return Dropped;
+    }
+    if (queued_ + f->size() > hard_limit_) return Overflow;
+
+    size_t done = 0;
+    if (q_.empty()) {
+        // header and body go out in a single write
+        ssize_t n;
+        do n = ::send(sock, f->data(), f->size(), MSG_NOSIGNAL);
+        while (n < 0 && errno == EINTR);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            failed_ = true;
+            return Failed;
+        }
+        if (n == (ssize_t)f->size()) return Sent;
+        if (n > 0) done = n;
+    }
+    // keep a reference to the tail, the socket is full until EPOLLOUT
+    if (q_.empty()) off_ = done;
+    q_.push_back(f);
+    queued_ += f->size() - done;
+    return Queued;
+}
+
+FrameWriter::Result FrameWriter::queue(const Frame &f, bool droppable) {
+    if (failed_) return Failed;
+    if (droppable && queued_ >= high_water_) {
+        ++dropped_;
+        return Dropped;
+    }
+    if (queued_ + f->size() > hard_limit_) return Overflow;
+    if (q_.empty()) off_ = 0;
+    q_.push_back(f);
+    queued_ += f->size();
+    return Queued;
+}
+
+bool FrameWriter::flush(int sock) {
+    if (failed_) return false;
+    while (!q_.empty()) {
+        iovec iov[64];
+        size_t cnt = 0, want = 0;
+        for (auto it = q_.begin(); it != q_.end() && cnt < 64; ++it, ++cnt) {
+            size_t skip = cnt == 0 ? off_ : 0;
+            iov[cnt].iov_base = const_cast<char *>((*it)->data()) + skip;
+            iov[cnt].iov_len = (*it)->size() - skip;
+            want += iov[cnt].iov_len;
+        }
+        msghdr mh{};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = cnt;
+        ssize_t n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true; // rest goes on EPOLLOUT
+            failed_ = true;
+            return false;
+        }
+        queued_ -= n;
+        for (size_t left = n; left > 0; ) {
+            size_t rest = q_.front()->size() - off_;
+            if (left < rest) {
+                off_ += left;
+                break;
+            }
+            left -= rest;
+            q_.pop_front();
+            off_ = 0;
+        }
+        if ((size_t)n < want) return true; // socket buffer is full
+    }
+    return true;
+}
@@ -1,6 +1,83 @@
 #pragma once
 #include <string>
+#include <cstddef>
+#include <deque>
+#include <memory>
 
+// Blocking sockets only: on a non-blocking socket this spins until the peer drains, use FrameWriter.
 bool send_message(int sock, const std::string &msg);
+// Blocking sockets only: on a non-blocking socket a frame split across wakeups is lost, use FrameReader.
 std::string recv_message(int sock);
 std::string now_time_str();
+int make_socket_non_blocking(int s);
+// Turn off Nagle so small frames (snapshots, acks) leave as soon as they are written.
+int set_no_delay(int s);
+// Write all `n` bytes to a file, retrying short writes and EINTR; false on any other error.
+bool write_fully(int fd, const char *p, size_t n);
+
+const unsigned MAX_FRAME_LEN = 65536; // largest body a length header may announce
+
+// Reassembles length-prefixed frames read from one socket across epoll wakeups.
+// Partial headers and bodies stay buffered until the rest arrives, and a single
+// read() may yield any number of complete frames.
+class FrameReader {
+public:
+    enum Status { Open, Closed, Error };
+
+    // Read everything the socket has right now (until EAGAIN), never blocks.
+    // Frames buffered before Closed/Error can still be taken with next().
+    Status fill(int sock);
+
+    // Pop the next complete frame; false when none is buffered yet or the stream is corrupt.
+    bool next(std::string &out);
+
+    // The peer announced an invalid frame length, the connection should be dropped.
+    bool corrupt() const { return corrupt_; }
+    size_t buffered() const { return buf_.size() - pos_; }
+
+private:
+    std::string buf_;
+    size_t pos_ = 0;
+    bool corrupt_ = false;
+};
+
+// Per-connection outbound queue for non-blocking sockets.
+// Frames are written immediately when the socket accepts them, the rest is kept and
+// written by flush() on EPOLLOUT. Once `high_water` bytes are queued, droppable frames
+// (state snapshots) are skipped instead of queued; a frame that would take the queue
+// past `hard_limit` is refused so the owner can disconnect the peer.
+// Queues hold references to immutable pre-framed buffers, so a frame broadcast to
+// many sockets is framed once and an unsent tail is never copied.
+class FrameWriter {
+public:
+    enum Result { Sent, Queued, Dropped, Overflow, Failed };
+    using Frame = std::shared_ptr<const std::string>; // length header + body
+
+    FrameWriter(size_t high_water = 256 * 1024, size_t hard_limit = 4 * 1024 * 1024)
+        : high_water_(high_water), hard_limit_(hard_limit) {}
+
+    static Frame frame(const std::string &msg);
+
+    Result send(int sock, const std::string &msg, bool droppable = false) { return send(sock, frame(msg), droppable); }
+    // One write when nothing is queued; otherwise the frame waits for flush() on EPOLLOUT.
+    Result send(int sock, const Frame &f, bool droppable = false);
+    // Append without writing, so frames produced in one wakeup leave together in the
+    // caller's next flush().
+    Result queue(const Frame &f, bool droppable = false);
+    // Write as much of the queue as the socket takes (one sendmsg per up to 64 frames);
+    // false once the socket has failed.
+    bool flush(int sock);
+
+    bool idle() const { return q_.empty(); }
+    size_t queued_bytes() const { return queued_; }
+    size_t dropped() const { return dropped_; }
+
+private:
+    std::deque<Frame> q_;
+    size_t off_ = 0;            // bytes of q_.front() already written
+    size_t queued_ = 0;
+    size_t dropped_ = 0;
+    size_t high_water_, hard_limit_;
+    bool failed_ = false;
+};
+
@@ -0,0 +1,223 @@
+#include "wal.h"
+#include "utility.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const array<uint32_t, 256> CRC_TABLE = [] {
+    array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        t[i] = c;
+    }
+    return t;
+}();
+
+static uint32_t crc32(const char *p, size_t n) {
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; ++i) c = CRC_TABLE[(c ^ static_cast<uint8_t>(p[i])) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void put_record(string &out, const string &payload) {
+    uint32_t hdr[2] = {htonl(static_cast<uint32_t>(payload.size())), htonl(crc32(payload.data(), payload.size()))};
+    out.append(reinterpret_cast<const char *>(hdr), sizeof(hdr));
+    out += payload;
+}
+
+// Calls `each` for every intact record in `buf`; returns the offset of the first byte not consumed.
+static size_t scan_records(const string &buf, const function<void(const string &)> &each) {
+    size_t pos = 0;
+    while (buf.size() - pos >= 8) {
+        uint32_t hdr[2];
+        memcpy(hdr, buf.data() + pos, sizeof(hdr));
+        uint32_t len = ntohl(hdr[0]), crc = ntohl(hdr[1]);
+        if (buf.size() - pos - 8 < len) break;              // torn tail
+        if (crc32(buf.data() + pos + 8, len) != crc) break; // corrupt
+        each(buf.substr(pos + 8, len));
+        pos += 8 + len;
+    }
+    return pos;
+}
+
+static string read_file(const string &path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void sync_dir(const string &dir) {
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    ::close(fd);
+}
+
+// Files in `dir` named <prefix><n><ext>, by n.
+static vector<pair<uint64_t, string>> list_numbered(const string &dir, const string &prefix, const string &ext) {
+    vector<pair<uint64_t, string>> res;
+    error_code ec;
+    for (auto &e : fs::directory_iterator(dir, ec)) {
+        string name = e.path().filename().string();
+        if (name.size() <= prefix.size() + ext.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - ext.size(), ext.size(), ext) != 0)
+            continue;
+        string num = name.substr(prefix.size(), name.size() - prefix.size() - ext.size());
+        if (num.find_first_not_of("0123456789") != string::npos) continue;
+        res.emplace_back(stoull(num), e.path().string());
+    }
+    sort(res.begin(), res.end());
+    return res;
+}
+
+string WriteAheadLog::path(const char *prefix, uint64_t n, const char *ext) const {
+    return dir_ + "/" + prefix + to_string(n) + ext;
+}
+
+bool WriteAheadLog::recover(const function<void(const string &)> &load, const function<void(const string &)> &replay) {
+    error_code ec;
+    fs::create_directories(dir_, ec);
+
+    auto snaps = list_numbered(dir_, "snapshot-", ".dat");
+    uint64_t base = 0;
+    for (auto it = snaps.rbegin(); it != snaps.rend(); ++it) {
+        string buf = read_file(it->second), body;
+        size_t used = scan_records(buf, [&](const string &rec) { body = rec; });
+        if (used == 0 || used != buf.size()) {
+            cerr << "[WAL] Skipping damaged snapshot " << it->second << endl;
+            continue;
+        }
+        load(body);
+        base = it->first;
+        break;
+    }
+
+    uint64_t next = base;
+    size_t records = 0;
+    for (auto &[n, file] : list_numbered(dir_, "wal-", ".log")) {
+        next = max(next, n + 1);
+        if (n < base) continue;
+        string buf = read_file(file);
+        size_t used = scan_records(buf, [&](const string &rec) {
+            replay(rec);
+            ++records;
+        });
+        if (used != buf.size())
+            cerr << "[WAL] " << file << ": ignoring " << buf.size() - used << " bytes after the last intact record" << endl;
+    }
+    cout << "[WAL] Recovered snapshot " << base << " + " << records << " log record(s)" << endl;
+
+    // leftovers of a compaction that was interrupted after its snapshot became durable
+    for (auto &[n, file] : list_numbered(dir_, "wal-", ".log"))
+        if (n < base) fs::remove(file, ec);
+    for (auto &[n, file] : list_numbered(dir_, "snapshot-", ".dat"))
+        if (n != base) fs::remove(file, ec);
+    for (auto &[n, file] : list_numbered(dir_, "snapshot-", ".tmp")) fs::remove(file, ec);
+
+    since_snapshot_ = records;
+    return open_segment(next);
+}
+
+bool WriteAheadLog::open_segment(uint64_t n) {
+    int fd = ::open(path("wal-", n, ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "[WAL] Cannot open segment " << n << ": " << strerror(errno) << endl;
+        return false;
+    }
+    sync_dir(dir_);
+    if (fd_ >= 0) {
+        if (fsync_ms_ >= 0 && unsynced_) fdatasync(fd_);
+        ::close(fd_);
+    }
+    fd_ = fd;
+    seg_ = n;
+    unsynced_ = false;
+    return true;
+}
+
+void WriteAheadLog::append(const string &payload) {
+    put_record(pending_, payload);
+    ++since_snapshot_;
+}
+
+bool WriteAheadLog::commit() {
+    if (pending_.empty() || fd_ < 0) return pending_.empty();
+    bool ok = write_fully(fd_, pending_.data(), pending_.size());
+    pending_.clear();
+    if (!ok) {
+        cerr << "[WAL] Write failed: " << strerror(errno) << endl;
+        return false;
+    }
+    unsynced_ = true;
+    auto now = chrono::steady_clock::now();
+    if (fsync_ms_ == 0 || (fsync_ms_ > 0 && now - last_sync_ >= chrono::milliseconds(fsync_ms_))) {
+        if (fdatasync(fd_) < 0) {
+            cerr << "[WAL] fdatasync failed: " << strerror(errno) << endl;
+            return false;
+        }
+        unsynced_ = false;
+        last_sync_ = now;
+    }
+    return true;
+}
+
+void WriteAheadLog::snapshot(function<string()> encode) {
+    if (snapshot_running() || fd_ < 0) return;
+    if (snap_thread_.joinable()) snap_thread_.join();
+    commit();
+    if (!open_segment(seg_ + 1)) return;
+    since_snapshot_ = 0;
+    snap_done_ = false;
+    snap_thread_ = thread([this, seg = seg_, encode = std::move(encode)] {
+        write_snapshot(seg, encode());
+        snap_done_ = true;
+    });
+}
+
+void WriteAheadLog::write_snapshot(uint64_t seg, const string &body) {
+    string buf;
+    put_record(buf, body);
+    string tmp = path("snapshot-", seg, ".tmp"), final_path = path("snapshot-", seg, ".dat");
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || !write_fully(fd, buf.data(), buf.size()) || fsync(fd) < 0) {
+        cerr << "[WAL] Snapshot " << seg << " failed: " << strerror(errno) << endl;
+        if (fd >= 0) ::close(fd);
+        return;
+    }
+    ::close(fd);
+    if (rename(tmp.c_str(), final_path.c_str()) < 0) {
+        cerr << "[WAL] Snapshot " << seg << " rename failed: " << strerror(errno) << endl;
+        return;
+    }
+    sync_dir(dir_);
+
+    // everything before `seg` is now covered by the snapshot
+    error_code ec;
+    for (auto &[n, file] : list_numbered(dir_, "wal-", ".log"))
+        if (n < seg) fs::remove(file, ec);
+    for (auto &[n, file] : list_numbered(dir_, "snapshot-", ".dat"))
+        if (n < seg) fs::remove(file, ec);
+    cout << "[WAL] Snapshot " << seg << " written (" << body.size() << " bytes)" << endl;
+}
+
+void WriteAheadLog::close() {
+    if (fd_ >= 0) {
+        commit();
+        if (fsync_ms_ >= 0 && unsynced_) fdatasync(fd_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (snap_thread_.joinable()) snap_thread_.join();
+}
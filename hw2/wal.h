@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Append-only operation log plus compacted snapshots, kept in one directory.
+// Records go to segments wal-<n>.log, each framed as [u32 length][u32 crc32][payload]
+// (big-endian). snapshot-<n>.dat holds one such record with the whole state as of the
+// start of segment n, so recovery loads the newest snapshot that verifies and replays
+// segments n, n+1, ... up to the first torn or corrupt record.
+class WriteAheadLog {
+public:
+    // fsync_ms: 0 syncs every commit, N > 0 syncs on the first commit N ms after the
+    // previous sync, and a negative value leaves syncing to the OS.
+    WriteAheadLog(const std::string &dir, int fsync_ms = 0) : dir_(dir), fsync_ms_(fsync_ms) {}
+    ~WriteAheadLog() { close(); }
+
+    // Hands the newest valid snapshot body to `load` (skipped if there is none), then each
+    // intact record logged after it to `replay`, and opens a fresh segment for appends.
+    // False if the log directory cannot be written.
+    bool recover(const std::function<void(const std::string &)> &load,
+                 const std::function<void(const std::string &)> &replay);
+
+    // Buffered in memory until the next commit().
+    void append(const std::string &payload);
+    // One write (and fsync, per policy) for everything appended since the last commit,
+    // so a burst of requests shares a single disk round trip. False on an I/O error.
+    bool commit();
+    // Position in the uncommitted tail; rollback(mark()) drops everything appended after it,
+    // records counted towards the next snapshot included.
+    struct Mark {
+        size_t bytes, records;
+    };
+    Mark mark() const { return {pending_.size(), since_snapshot_}; }
+    void rollback(Mark m) {
+        pending_.resize(m.bytes);
+        since_snapshot_ = m.records;
+    }
+
+    size_t records_since_snapshot() const { return since_snapshot_; }
+    bool snapshot_running() const { return snap_thread_.joinable() && !snap_done_; }
+
+    // Starts a new segment and runs `encode` on a background thread; its result is
+    // written as the snapshot for that segment, after which the older segments and
+    // snapshots are deleted. `encode` must only touch state it owns (a copy). No-op
+    // while the previous snapshot is still being written.
+    void snapshot(std::function<std::string()> encode);
+
+    // Commits, syncs and waits for a running snapshot.
+    void close();
+
+private:
+    bool open_segment(uint64_t n);
+    void write_snapshot(uint64_t seg, const std::string &body);
+    std::string path(const char *prefix, uint64_t n, const char *ext) const;
+
+    std::string dir_;
+    int fsync_ms_;
+    int fd_ = -1;
+    uint64_t seg_ = 0;
+    std::string pending_;
+    bool unsynced_ = false;
+    std::chrono::steady_clock::time_point last_sync_{};
+    size_t since_snapshot_ = 0;
+    std::thread snap_thread_;
+    std::atomic<bool> snap_done_{false};
+};